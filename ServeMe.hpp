@@ -4,17 +4,33 @@
 // Brief documentation of the current REST API
 // Capabilities:
 // 1. GET/POST requests handling
-// 2. Response Raw data + data from file
+// 2. Response Raw data + data from file (private in-memory snapshots refreshed on change, or sent with sendfile)
 // 3. Exceptions handling (signals - not yet)
 // 4. Easy-to-use public API (see RESTAPIAPP class)
 // 5. Basic templates
 // 6. Availability to inherit & fast create custom servers
 // 7. Logging info with levels and modes
-// 8. Logging into file & syslog
-// 9. Caching queries
+// 8. Logging into file & syslog, synchronous or asynchronous (see Logger::enableAsync)
+// 9. Caching files served without the mappings (bounded sharded LRU cache)
 // 10. Easy connect: just include this .hpp file into your project
-// Dependency libraries: boost lib
-// Dependency includes: see below (8 includes)
+// 11. Worker threads pool or shared-nothing thread-per-core mode (see ThreadingMode)
+// 12. HTTP/1.1 persistent connections (keep-alive) with requests limit & idle timeout
+// 13. Pipelining & incremental zero-allocation request parser (see HttpRequestParser, benchmarks/)
+// 14. Compile-time perfect-hash routes for endpoint sets known at build time (see StaticRouteTable)
+// 15. Radix-tree routing with :param & *wildcard segments, query strings are split off (see Router)
+// 16. Handler endpoints: in-process dynamic responses written into reused buffers (see Handler)
+// 17. Request bodies by Content-Length or chunked, buffered or streamed to the endpoint (see BodyReader)
+// 18. Chunked streaming responses with write backpressure (see ResponseStream)
+// 19. Precompressed gzip/brotli/zstd variants & sibling .gz/.br/.zst files by Accept-Encoding (see EncodedVariants)
+// 20. ETag & Last-Modified validators, conditional GET answered with prebuilt 304 responses
+// 21. Request-scoped data in a per-session arena, no heap allocations on the hot path (see AllocationCounter)
+// 22. Per-thread pools of closed sessions & read buffers for new connections (see PoolAllocator)
+// 23. Asynchronous operation states in per-session recycled memory (see HandlerMemory)
+// 24. Scatter-gather responses: prebuilt heads & referenced bodies go out with one gather write, never concatenated
+// 25. Prometheus metrics: per-thread counters & latency histograms aggregated on scrape (see Metrics)
+// 26. Admission control: a sessions limit with a low-water mark, pausing the accept or answering 503 (see Admission)
+// Dependency libraries: boost lib; optional: zlib, brotli, zstd
+// Dependency includes: see below (31 includes)
 // Feature: Hard parallelism under the hood
 // For more read inline comments & official documentation of boost library
 // Updates are comming...
@@ -22,32 +38,87 @@
 
 #include <boost/asio.hpp>
 #include <boost/exception/diagnostic_information.hpp>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <fcntl.h>
 #include <fstream>
+#include <functional>
 #include <iostream>
+#include <list>
 #include <map>
+#include <memory_resource>
+#include <mutex>
+#include <shared_mutex>
 #include <sstream>
+#include <stdexcept>
+#include <string_view>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
 #include <syslog.h>
+#include <thread>
+#include <unistd.h>
 #include <vector>
 
+// Optional codecs of the precompressed responses (see EncodedVariants): define the macros before including
+// this file & link the libraries
+//#define SERVEME_WITH_ZLIB    // gzip, -lz
+//#define SERVEME_WITH_BROTLI  // br, -lbrotlienc
+//#define SERVEME_WITH_ZSTD    // zstd, -lzstd
+#ifdef SERVEME_WITH_ZLIB
+#include <zlib.h>
+#endif
+#ifdef SERVEME_WITH_BROTLI
+#include <brotli/encode.h>
+#endif
+#ifdef SERVEME_WITH_ZSTD
+#include <zstd.h>
+#endif
+
 namespace Utils {
 //#define DEBUG  // uncomment this line to see all Logs (this macros enables debug logs)
-    namespace {
-        std::mutex mu;
-        const std::string filePrefix = "@file:";
-        typedef std::unordered_map<std::string, std::string> CACHE;
+    // the enums are members of the public classes, so they stay out of the anonymous namespace
+    enum class Level {
+        Debug = 0,
+        Info,
+        Warning,
+        Error,
+        Critical
+    };
 
-        enum class Level {
-            Debug = 0,
-            Info,
-            Warning,
-            Error,
-            Critical
-        };
+    enum class Method {
+        GET = 0,
+        POST
+    };
+    constexpr std::size_t METHODS_COUNT = 2;
 
-        enum class Method {
-            GET = 0,
-            POST
-        };
+    enum class OverflowPolicy {
+        Drop = 0,  // the record is lost & counted, the caller never waits
+        Block      // the caller waits until the background flusher frees a slot
+    };
+
+    enum class AdmissionPolicy {
+        Pause = 0,  // over the sessions limit the server stops accepting, the connections wait in the listen backlog
+        Reject      // over the sessions limit the connections are accepted & answered with 503 & Retry-After
+    };
+
+    enum class ThreadingMode {
+        SharedPool = 0,  // one io_context, acceptor, cache & logger run by all the worker threads
+        PerCore          // every worker thread owns its io_context, SO_REUSEPORT acceptor, cache & logger
+    };
+
+    namespace {
+        const std::string filePrefix = "@file:";
+        typedef boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT> reuse_port;
+        typedef boost::asio::detail::socket_option::boolean<IPPROTO_TCP, TCP_CORK> tcp_cork;
 
         int getPriority(Level level) noexcept {
             switch (level) {
@@ -82,6 +153,67 @@ namespace Utils {
                     return "[INFO]";
             }
         }
+
+        /// ASCII-only, unlike std::tolower it does not look into the locale
+        constexpr char toLower(char c) noexcept {
+            return c >= 'A' && c <= 'Z' ? static_cast<char>(c - 'A' + 'a') : c;
+        }
+
+        constexpr bool isTokenChar(unsigned char c) noexcept {
+            if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9')) {
+                return true;
+            }
+            switch (c) {
+                case '!': case '#': case '$': case '%': case '&': case '\'': case '*': case '+':
+                case '-': case '.': case '^': case '_': case '`': case '|': case '~':
+                    return true;
+                default:
+                    return false;
+            }
+        }
+
+        /// the characters allowed in methods & header names (RFC 9110 tchar)
+        constexpr std::array<bool, 256> TOKEN_CHARS = [] {
+            std::array<bool, 256> table{};
+            for (std::size_t c = 0; c < table.size(); ++c) {
+                table[c] = isTokenChar(static_cast<unsigned char>(c));
+            }
+            return table;
+        }();
+
+        bool iequals(std::string_view lhs, std::string_view rhs) noexcept {
+            if (lhs.size() != rhs.size()) {
+                return false;
+            }
+            for (std::size_t i = 0; i < lhs.size(); ++i) {
+                if (toLower(lhs[i]) != toLower(rhs[i])) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        std::string_view trim(std::string_view str) noexcept {
+            while (!str.empty() && (str.front() == ' ' || str.front() == '\t')) {
+                str.remove_prefix(1);
+            }
+            while (!str.empty() && (str.back() == ' ' || str.back() == '\t' || str.back() == '\r')) {
+                str.remove_suffix(1);
+            }
+            return str;
+        }
+
+        /// @return true if the comma-separated header value (e.g. "keep-alive, Upgrade") contains the token
+        bool hasToken(std::string_view list, std::string_view token) noexcept {
+            while (!list.empty()) {
+                std::size_t comma = list.find(',');
+                if (iequals(trim(list.substr(0, comma)), token)) {
+                    return true;
+                }
+                list = comma == std::string_view::npos ? std::string_view() : list.substr(comma + 1);
+            }
+            return false;
+        }
     }// namespace
 
     namespace Interfaces {
@@ -91,7 +223,7 @@ namespace Utils {
         };
         class LoggerInterface {
         public:
-            virtual void log(Level level, const std::string &message) noexcept = 0;
+            virtual void log(Level level, std::string_view message) noexcept = 0;
         };
         class HttpSessionInterface {
         public:
@@ -105,227 +237,3994 @@ namespace Utils {
         };
     }// namespace Interfaces
 
+    /// Heap allocations of the calling thread, to check that a code path does not allocate
+    /// Counting is off unless exactly one translation unit defines SERVEME_COUNT_ALLOCATIONS before including
+    /// this file: it replaces the global operator new, so count() stays 0 otherwise
+    namespace AllocationCounter {
+        inline thread_local std::uint64_t allocations = 0;
+
+        /// @return the number of operator new calls made by this thread so far
+        inline std::uint64_t count() noexcept {
+            return allocations;
+        }
+    }// namespace AllocationCounter
+
+    /// Process-wide counters & latency histograms, exported in the Prometheus text format by scrape()
+    /// Every thread records into its own cache-line-aligned slot with plain relaxed stores (no locked
+    /// instructions, no shared lines), the slots are summed only on scrape: recording costs a few nanoseconds
+    class Metrics {
+    public:
+        // the ids per process, the two below included: every thread keeps a pointer per id (32 KB), the counters
+        // of an endpoint are allocated on its first request; the endpoints registered beyond share OVER_LIMIT
+        static constexpr std::size_t MAX_ENDPOINTS = 4096;
+        static constexpr std::size_t STATUS_CLASSES = 5;   // 1xx .. 5xx
+        static constexpr std::uint32_t UNMATCHED = 0;      // the requests without an endpoint, e.g. 404 & rejected ones
+        static constexpr std::uint32_t OVER_LIMIT = 1;     // the endpoints beyond MAX_ENDPOINTS, labeled "(overflow)"
+
+        /// A counter written by the thread of its slot only
+        class Counter {
+        public:
+            void add(std::uint64_t n = 1) noexcept {
+                value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+            }
+
+            std::uint64_t get() const noexcept {
+                return value.load(std::memory_order_relaxed);
+            }
+
+        private:
+            std::atomic<std::uint64_t> value{0};
+        };
+
+        /// Log-linear histogram of nanoseconds (HDR-style): 8 linear buckets per power of two, so a recorded value
+        /// is known within 12.5%; the values above 2^37 ns (about two minutes) fall into the last bucket
+        class Histogram {
+        public:
+            static constexpr unsigned SUB_BITS = 3;
+            static constexpr unsigned MAX_EXPONENT = 36;
+            static constexpr std::size_t BUCKETS = (MAX_EXPONENT - SUB_BITS + 2) << SUB_BITS;
+
+            void record(std::uint64_t nanoseconds) noexcept {
+                buckets[index(nanoseconds)].add();
+                count.add();
+                sum.add(nanoseconds);
+            }
+
+            static std::size_t index(std::uint64_t value) noexcept {
+                if (value < (1u << SUB_BITS)) {
+                    return static_cast<std::size_t>(value);
+                }
+                unsigned exponent = 63 - static_cast<unsigned>(__builtin_clzll(value));
+                if (exponent > MAX_EXPONENT) {
+                    return BUCKETS - 1;
+                }
+                return ((exponent - SUB_BITS + 1) << SUB_BITS) + ((value >> (exponent - SUB_BITS)) & ((1u << SUB_BITS) - 1));
+            }
+
+            /// @return the middle of the values of the bucket
+            static std::uint64_t value(std::size_t index) noexcept {
+                if (index < (1u << SUB_BITS)) {
+                    return index;
+                }
+                unsigned shift = static_cast<unsigned>(index >> SUB_BITS) - 1;
+                std::uint64_t lowest = ((1u << SUB_BITS) + (index & ((1u << SUB_BITS) - 1))) << shift;
+                return lowest + ((std::uint64_t(1) << shift) >> 1);
+            }
+
+            std::array<Counter, BUCKETS> buckets;
+            Counter count;
+            Counter sum;
+        };
+
+        /// What is recorded per endpoint
+        struct alignas(64) EndpointSlot {
+            std::array<Counter, STATUS_CLASSES> responses;  // written responses by status class
+            Histogram parse;    // the request line & headers
+            Histogram handler;  // from the parsed request to the queued response: routing, handler, cache
+            Histogram write;    // from the start of the write to its completion
+        };
+
+        /// The counters of one thread
+        struct alignas(64) Slot {
+            Slot() = default;
+            Slot(const Slot &) = delete;
+            Slot &operator=(const Slot &) = delete;
+
+            ~Slot() {
+                for (auto &endpoint : endpoints) {
+                    delete endpoint.load(std::memory_order_relaxed);
+                }
+            }
+
+            /// @param id - see Metrics::endpoint; allocated on the first request of the thread to the endpoint
+            EndpointSlot &endpoint(std::uint32_t id) {
+                std::atomic<EndpointSlot *> &slot = endpoints[id < MAX_ENDPOINTS ? id : OVER_LIMIT];
+                EndpointSlot *endpoint = slot.load(std::memory_order_relaxed);
+                if (!endpoint) {
+                    endpoint = new EndpointSlot();
+                    slot.store(endpoint, std::memory_order_release);
+                }
+                return *endpoint;
+            }
+
+            Counter accepts;
+            Counter rejections;
+            Counter sessions_opened;
+            Counter sessions_closed;
+            Counter cache_hits;
+            Counter cache_misses;
+            Counter cache_evictions;
+            Counter bytes_received;
+            Counter bytes_sent;
+            Counter log_drops;
+            std::array<std::atomic<EndpointSlot *>, MAX_ENDPOINTS> endpoints{};
+        };
+
+        static Metrics &instance() {
+            static Metrics metrics;
+            return metrics;
+        }
+
+        /// @return the slot of the calling thread, registered on the first call
+        static Slot &local() {
+            static thread_local Slot *slot = nullptr;
+            if (!slot) {
+                slot = instance().attach();
+            }
+            return *slot;
+        }
+
+        /// Registers an endpoint once, whatever the number of servers registering it
+        /// @return the id for Slot::endpoint
+        std::uint32_t endpoint(Method method, std::string_view path) {
+            std::string_view name = method == Method::GET ? "GET" : "POST";
+            std::lock_guard lock(mutex);
+            for (std::size_t id = OVER_LIMIT + 1; id < names.size(); ++id) {
+                if (names[id].first == name && names[id].second == path) {
+                    return static_cast<std::uint32_t>(id);
+                }
+            }
+            if (names.size() == MAX_ENDPOINTS) {
+                return OVER_LIMIT;
+            }
+            names.emplace_back(name, path);
+            return static_cast<std::uint32_t>(names.size() - 1);
+        }
+
+        /// @return all the metrics in the Prometheus text format (version 0.0.4)
+        std::string scrape() const {
+            std::lock_guard lock(mutex);
+            std::string out;
+            auto total = [this](Counter Slot::*counter) {
+                std::uint64_t sum = 0;
+                for (const auto &slot : slots) {
+                    sum += ((*slot).*counter).get();
+                }
+                return sum;
+            };
+            auto counter = [&out](const char *name, const char *help, const char *type, std::uint64_t value) {
+                out.append("# HELP ").append(name).append(" ").append(help).append("\n# TYPE ").append(name).append(" ")
+                   .append(type).append("\n").append(name).append(" ").append(std::to_string(value)).append("\n");
+            };
+            counter("serveme_accepts_total", "Accepted connections.", "counter", total(&Slot::accepts));
+            counter("serveme_rejected_total", "Connections over the sessions limit answered with 503.", "counter",
+                    total(&Slot::rejections));
+            counter("serveme_active_sessions", "Open connections.", "gauge",
+                    total(&Slot::sessions_opened) - total(&Slot::sessions_closed));
+            counter("serveme_cache_hits_total", "Response cache hits.", "counter", total(&Slot::cache_hits));
+            counter("serveme_cache_misses_total", "Response cache misses.", "counter", total(&Slot::cache_misses));
+            counter("serveme_cache_evictions_total", "Response cache evictions.", "counter", total(&Slot::cache_evictions));
+            counter("serveme_received_bytes_total", "Bytes read from the sockets.", "counter", total(&Slot::bytes_received));
+            counter("serveme_sent_bytes_total", "Bytes written to the sockets.", "counter", total(&Slot::bytes_sent));
+            counter("serveme_log_dropped_total", "Log records dropped by a full asynchronous log.", "counter", total(&Slot::log_drops));
+
+            // per endpoint: the slots of all the threads summed up
+            std::vector<std::array<std::uint64_t, STATUS_CLASSES>> responses(names.size());
+            std::vector<std::array<std::vector<std::uint64_t>, 3>> histograms(names.size());
+            std::vector<std::array<std::uint64_t, 3>> counts(names.size()), sums(names.size());
+            std::vector<bool> seen(names.size());
+            for (const auto &slot : slots) {
+                for (std::size_t id = 0; id < names.size(); ++id) {
+                    const EndpointSlot *endpoint = slot->endpoints[id].load(std::memory_order_acquire);
+                    if (!endpoint) {
+                        continue;
+                    }
+                    seen[id] = true;
+                    for (std::size_t i = 0; i < STATUS_CLASSES; ++i) {
+                        responses[id][i] += endpoint->responses[i].get();
+                    }
+                    const Histogram *phases[] = {&endpoint->parse, &endpoint->handler, &endpoint->write};
+                    for (std::size_t phase = 0; phase < 3; ++phase) {
+                        histograms[id][phase].resize(Histogram::BUCKETS);
+                        for (std::size_t i = 0; i < Histogram::BUCKETS; ++i) {
+                            histograms[id][phase][i] += phases[phase]->buckets[i].get();
+                        }
+                        counts[id][phase] += phases[phase]->count.get();
+                        sums[id][phase] += phases[phase]->sum.get();
+                    }
+                }
+            }
+            out.append("# HELP serveme_responses_total Written responses by endpoint & status class.\n"
+                       "# TYPE serveme_responses_total counter\n");
+            for (std::size_t id = 0; id < names.size(); ++id) {
+                for (std::size_t i = 0; seen[id] && i < STATUS_CLASSES; ++i) {
+                    if (responses[id][i] != 0) {
+                        out.append("serveme_responses_total{").append(labels(id)).append(",code=\"")
+                           .append(std::to_string(i + 1)).append("xx\"} ").append(std::to_string(responses[id][i])).append("\n");
+                    }
+                }
+            }
+            const char *phases[][2] = {{"serveme_parse_seconds", "Parsing of the request line & headers."},
+                                       {"serveme_handler_seconds", "Routing & building of the response."},
+                                       {"serveme_write_seconds", "Writing of the response batch."}};
+            for (std::size_t phase = 0; phase < 3; ++phase) {
+                out.append("# HELP ").append(phases[phase][0]).append(" ").append(phases[phase][1]).append("\n# TYPE ")
+                   .append(phases[phase][0]).append(" summary\n");
+                for (std::size_t id = 0; id < names.size(); ++id) {
+                    if (!seen[id] || counts[id][phase] == 0) {
+                        continue;
+                    }
+                    for (double q : {0.5, 0.9, 0.99, 0.999}) {
+                        out.append(phases[phase][0]).append("{").append(labels(id)).append(",quantile=\"")
+                           .append(format(q)).append("\"} ")
+                           .append(format(quantile(histograms[id][phase], counts[id][phase], q) * 1e-9)).append("\n");
+                    }
+                    out.append(phases[phase][0]).append("_sum{").append(labels(id)).append("} ")
+                       .append(format(static_cast<double>(sums[id][phase]) * 1e-9)).append("\n");
+                    out.append(phases[phase][0]).append("_count{").append(labels(id)).append("} ")
+                       .append(std::to_string(counts[id][phase])).append("\n");
+                }
+            }
+            return out;
+        }
+
+    private:
+        Metrics() : names{{"", ""}, {"", ""}} {}  // UNMATCHED & OVER_LIMIT
+
+        Slot *attach() {
+            auto slot = std::make_unique<Slot>();
+            std::lock_guard lock(mutex);
+            slots.push_back(std::move(slot));  // kept after the thread exits: its counts stay in the totals
+            return slots.back().get();
+        }
+
+        /// @return the value at the quantile, in nanoseconds
+        static double quantile(const std::vector<std::uint64_t> &buckets, std::uint64_t count, double q) {
+            auto rank = static_cast<std::uint64_t>(std::ceil(q * static_cast<double>(count)));
+            std::uint64_t seen = 0;
+            for (std::size_t i = 0; i < buckets.size(); ++i) {
+                seen += buckets[i];
+                if (seen >= rank && seen > 0) {
+                    return static_cast<double>(Histogram::value(i));
+                }
+            }
+            return 0;
+        }
+
+        static std::string format(double value) {
+            char buffer[32];
+            std::snprintf(buffer, sizeof(buffer), "%.9g", value);
+            return buffer;
+        }
+
+        std::string labels(std::size_t id) const {
+            if (id == UNMATCHED) {
+                return "method=\"\",endpoint=\"(unmatched)\"";
+            }
+            if (id == OVER_LIMIT) {
+                return "method=\"\",endpoint=\"(overflow)\"";
+            }
+            std::string out = "method=\"" + names[id].first + "\",endpoint=\"";
+            for (char c : names[id].second) {
+                if (c == '"' || c == '\\') {
+                    out.push_back('\\');
+                }
+                out.push_back(c);
+            }
+            return out + "\"";
+        }
+
+        mutable std::mutex mutex;  // the registration of threads & endpoints, the scrape
+        std::vector<std::unique_ptr<Slot>> slots;
+        std::vector<std::pair<std::string, std::string>> names;  // (method, path) by endpoint id
+    };
+
+
+    /// Coarse wall clock: a timer on the io_context formats the current time once per tick, so the logger &
+    /// the Date header only copy a ready string; readers never lock (seqlock over atomic words)
+    class Clock {
+    public:
+        static constexpr std::size_t LOG_TIME_SIZE = 19;   // "2024-03-09 18:30:00", local time
+        static constexpr std::size_t HTTP_DATE_SIZE = 29;  // "Sat, 09 Mar 2024 15:30:00 GMT", IMF-fixdate
+
+        Clock() {
+            refresh();
+        }
+
+        /// Starts the refreshing; call stop() before the io_context is destroyed
+        /// @param resolution - the refresh period, one second is enough for both formats
+        void start(boost::asio::io_context &io_context, std::chrono::milliseconds resolution = std::chrono::seconds(1)) {
+            this->resolution = resolution;
+            timer = std::make_unique<boost::asio::steady_timer>(io_context);
+            schedule();
+        }
+
+        void stop() noexcept {
+            timer.reset();
+        }
+
+        /// @param out - receives LOG_TIME_SIZE chars, no terminating zero
+        void logTime(char *out) const noexcept {
+            read(out, LOG_TIME_OFFSET, LOG_TIME_SIZE);
+        }
+
+        /// @param out - receives the time as IMF-fixdate, HTTP_DATE_SIZE chars
+        static void formatHttpDate(std::time_t time, char *out) noexcept {
+            std::tm utc{};
+            gmtime_r(&time, &utc);
+            // formatted by hand: strftime names of days & months depend on the locale
+            char httpDate[80] = {0};
+            std::snprintf(httpDate, sizeof(httpDate), "%s, %02d %s %04d %02d:%02d:%02d GMT",
+                          DAYS[utc.tm_wday], utc.tm_mday, MONTHS[utc.tm_mon], utc.tm_year + 1900, utc.tm_hour, utc.tm_min, utc.tm_sec);
+            std::memcpy(out, httpDate, HTTP_DATE_SIZE);
+        }
+
+        /// @param date - an IMF-fixdate, e.g. of If-Modified-Since; the obsolete formats are not accepted
+        /// @return false if the date is malformed
+        static bool parseHttpDate(std::string_view date, std::time_t &time) noexcept {
+            if (date.size() != HTTP_DATE_SIZE || date.substr(3, 2) != ", " || date.substr(25) != " GMT") {
+                return false;
+            }
+            auto number = [date](std::size_t offset, std::size_t length, int &value) {
+                auto [end, ec] = std::from_chars(date.data() + offset, date.data() + offset + length, value);
+                return ec == std::errc() && end == date.data() + offset + length;
+            };
+            std::tm utc{};
+            auto month = std::find_if(std::begin(MONTHS), std::end(MONTHS), [date](const char *name) { return date.substr(8, 3) == name; });
+            if (month == std::end(MONTHS) || !number(5, 2, utc.tm_mday) || !number(12, 4, utc.tm_year)
+                || !number(17, 2, utc.tm_hour) || !number(20, 2, utc.tm_min) || !number(23, 2, utc.tm_sec)) {
+                return false;
+            }
+            utc.tm_mon = static_cast<int>(month - std::begin(MONTHS));
+            utc.tm_year -= 1900;
+            time = timegm(&utc);
+            return time != -1;
+        }
+
+        /// @param out - receives HTTP_DATE_SIZE chars, no terminating zero
+        void httpDate(char *out) const noexcept {
+            read(out, HTTP_DATE_OFFSET, HTTP_DATE_SIZE);
+        }
+
+        typedef std::shared_ptr<Clock> Ptr;
+
+    private:
+        static constexpr const char *DAYS[] = {"Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"};
+        static constexpr const char *MONTHS[] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+        static constexpr std::size_t LOG_TIME_OFFSET = 0;
+        static constexpr std::size_t HTTP_DATE_OFFSET = 24;
+        static constexpr std::size_t WORDS = (HTTP_DATE_OFFSET + HTTP_DATE_SIZE + 7) / 8;
+
+        void schedule() {
+            // tick right after the wall clock crosses the resolution boundary
+            auto now = std::chrono::system_clock::now().time_since_epoch();
+            auto wait = resolution - std::chrono::duration_cast<std::chrono::milliseconds>(now) % resolution;
+            timer->expires_after(wait);
+            timer->async_wait([this](const boost::system::error_code &ec) {
+                if (!ec) {
+                    refresh();
+                    schedule();
+                }
+            });
+        }
+
+        /// Single writer: the timer handler (or the constructor)
+        void refresh() noexcept {
+            // not std::time: it reads the coarse clock, which may still show the previous second at the tick
+            std::time_t now = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+            std::tm local{};
+            localtime_r(&now, &local);
+            char logTime[80] = {0};
+            std::snprintf(logTime, sizeof(logTime), "%04d-%02d-%02d %02d:%02d:%02d",
+                          local.tm_year + 1900, local.tm_mon + 1, local.tm_mday, local.tm_hour, local.tm_min, local.tm_sec);
+            std::array<std::uint64_t, WORDS> copy{};
+            std::memcpy(reinterpret_cast<char *>(copy.data()) + LOG_TIME_OFFSET, logTime, LOG_TIME_SIZE);
+            formatHttpDate(now, reinterpret_cast<char *>(copy.data()) + HTTP_DATE_OFFSET);
+            std::uint32_t current = sequence.load(std::memory_order_relaxed);
+            sequence.store(current + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            for (std::size_t i = 0; i < WORDS; ++i) {
+                words[i].store(copy[i], std::memory_order_relaxed);
+            }
+            sequence.store(current + 2, std::memory_order_release);
+        }
+
+        void read(char *out, std::size_t offset, std::size_t size) const noexcept {
+            std::array<std::uint64_t, WORDS> copy;
+            std::uint32_t before, after;
+            do {
+                before = sequence.load(std::memory_order_acquire);
+                for (std::size_t i = 0; i < WORDS; ++i) {
+                    copy[i] = words[i].load(std::memory_order_relaxed);
+                }
+                std::atomic_thread_fence(std::memory_order_acquire);
+                after = sequence.load(std::memory_order_relaxed);
+            } while (before != after || (before & 1));
+            std::memcpy(out, reinterpret_cast<const char *>(copy.data()) + offset, size);
+        }
+
+        alignas(64) std::atomic<std::uint32_t> sequence{0};  // odd while the words are being written
+        std::array<std::atomic<std::uint64_t>, WORDS> words{};
+        std::chrono::milliseconds resolution{1000};
+        std::unique_ptr<boost::asio::steady_timer> timer;
+    };
+
+    /// Bounded lock-free queue of preformatted log records (D. Vyukov's bounded queue):
+    /// any thread may push, only the background flusher pops; every slot carries its own sequence number
+    class LogRing {
+    public:
+        static constexpr std::size_t RECORD_SIZE = 500;  // longer records are truncated
+
+        struct Record {
+            Level level;
+            std::uint16_t length;
+            char text[RECORD_SIZE];
+        };
+
+        /// @param capacity - the number of records, rounded up to a power of two
+        explicit LogRing(std::size_t capacity) : slots(roundUp(capacity)), mask(slots.size() - 1) {
+            for (std::size_t i = 0; i < slots.size(); ++i) {
+                slots[i].sequence.store(i, std::memory_order_relaxed);
+            }
+        }
+
+        /// @param fill - called with the reserved Record to write it in place
+        /// @return false if the ring is full
+        template <class Fill>
+        bool tryPush(Fill &&fill) noexcept {
+            std::size_t position = tail.load(std::memory_order_relaxed);
+            while (true) {
+                Slot &slot = slots[position & mask];
+                std::size_t sequence = slot.sequence.load(std::memory_order_acquire);
+                auto diff = static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(position);
+                if (diff == 0) {
+                    if (tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                        fill(slot.record);
+                        slot.sequence.store(position + 1, std::memory_order_release);
+                        return true;
+                    }
+                } else if (diff < 0) {
+                    return false;
+                } else {
+                    position = tail.load(std::memory_order_relaxed);
+                }
+            }
+        }
+
+        /// Single consumer only
+        /// @param consume - called with the oldest Record before its slot is released
+        /// @return false if the ring is empty
+        template <class Consume>
+        bool tryPop(Consume &&consume) noexcept {
+            Slot &slot = slots[head & mask];
+            std::size_t sequence = slot.sequence.load(std::memory_order_acquire);
+            if (sequence != head + 1) {
+                return false;
+            }
+            consume(slot.record);
+            slot.sequence.store(head + slots.size(), std::memory_order_release);
+            ++head;
+            return true;
+        }
+
+    private:
+        struct alignas(64) Slot {
+            std::atomic<std::size_t> sequence;
+            Record record;
+        };
+
+        static std::size_t roundUp(std::size_t capacity) noexcept {
+            std::size_t size = 2;
+            while (size < capacity) {
+                size <<= 1;
+            }
+            return size;
+        }
+
+        std::vector<Slot> slots;
+        const std::size_t mask;
+        alignas(64) std::atomic<std::size_t> tail{0};  // producers
+        alignas(64) std::size_t head = 0;              // the consumer
+    };
+
+    class Logger : Interfaces::LoggerInterface {
+    public:
+        Logger(const std::string &program_name = "HTTPServer", const std::string &log_file_name = "log.txt",
+               bool syslog_enabled = true) try : syslogEnabled(syslog_enabled) {
+            try {
+                if (syslog_enabled) {
+                    openlog(program_name.c_str(), LOG_CONS | LOG_NDELAY | LOG_PID, LOG_USER);
+                }
+                logFile.open(log_file_name, std::ios::out | std::ios::app);
+#ifdef DEBUG
+                std::cout << getPrefix(Level::Debug) << " Logger object created";
+#endif
+            } catch (...) {
+                std::cerr << getPrefix(Level::Critical) + " Failed to open log file and/or system log\n";
+            }
+        } catch (...) {
+            std::cerr << "Failed to create Logger object\n";
+        }
+
+        ~Logger() {
+            try {
+                stopFlusher();
+                closelog();
+                logFile.close();
+#ifdef DEBUG
+                std::cout << getPrefix(Level::Debug) << " Logger object destroyed\n";
+#endif
+            } catch (...) {
+                std::cerr << getPrefix(Level::Critical) + " Failed to close log file and/or system log\n";
+            }
+        }
+
+        /// public API
+        /// @param level - the type of the logging, see enum Level
+        /// @param message - the log message; only read during the call
+        void log(Level level, std::string_view message) noexcept override {
+            if (ring) {
+                push(level, message);
+                return;
+            }
+            if (syslogEnabled) {
+                try {
+                    writeToSyslog(level, message);
+                } catch (...) {
+                    std::cerr << getPrefix(Level::Error) + " Failed to log to system log\n";
+                }
+            }
+            try {
+                writeToFile(level, message);
+            } catch (...) {
+                std::cerr << getPrefix(Level::Error) + " Failed to log to file\n";
+            }
+        }
+
+        /// Switches to the asynchronous mode: log() only formats the record & pushes it into a lock-free ring,
+        /// a background thread writes the records in large batches; the rest is flushed on destruction
+        /// Call it before the logger is used by several threads
+        /// @param policy - what log() does if the ring is full, see enum OverflowPolicy
+        /// @param capacity - the number of records the ring holds
+        void enableAsync(OverflowPolicy policy = OverflowPolicy::Drop, std::size_t capacity = 2048) {
+            if (ring) {
+                return;
+            }
+            overflowPolicy = policy;
+            ring = std::make_unique<LogRing>(capacity);
+            flusher = std::thread([this] { flushLoop(); });
+        }
+
+        /// @param clock - the source of the timestamps; without it every record calls localtime_r
+        void setClock(Clock::Ptr clock) {
+            this->clock = std::move(clock);
+        }
+
+        /// @return the number of records lost because the ring was full (OverflowPolicy::Drop)
+        std::uint64_t droppedCount() const noexcept {
+            return dropped.load(std::memory_order_relaxed);
+        }
+
+        typedef std::shared_ptr<Logger> Ptr;
+
+    private:
+        static constexpr std::size_t BATCH_SIZE = 64 * 1024;
+
+        void push(Level level, std::string_view message) noexcept {
+            char time[80] = {0};
+            formatTime(time, sizeof(time));
+            auto fill = [&](LogRing::Record &record) {
+                int length = std::snprintf(record.text, sizeof(record.text), "%s %s %.*s", time, getPrefix(level).c_str(),
+                                           static_cast<int>(message.size()), message.data());
+                record.level = level;
+                record.length = static_cast<std::uint16_t>(std::clamp(length, 0, static_cast<int>(sizeof(record.text)) - 1));
+            };
+            while (!ring->tryPush(fill)) {
+                if (overflowPolicy == OverflowPolicy::Drop) {
+                    dropped.fetch_add(1, std::memory_order_relaxed);
+                    Metrics::local().log_drops.add();
+                    return;
+                }
+                std::this_thread::yield();
+            }
+        }
+
+        void flushLoop() noexcept {
+            std::string batch;
+            batch.reserve(BATCH_SIZE + LogRing::RECORD_SIZE + 1);
+            std::uint64_t reported = 0;
+            while (true) {
+                bool stopping = stop.load(std::memory_order_acquire);
+                bool written = drain(batch, reported);
+                if (stopping) {
+                    break;  // everything pushed before the stop is already written
+                }
+                if (!written) {
+                    std::unique_lock lock(mutex);
+                    wakeUp.wait_for(lock, std::chrono::milliseconds(10), [this] { return stop.load(std::memory_order_acquire); });
+                }
+            }
+        }
+
+        /// @return true if at least one record was written
+        bool drain(std::string &batch, std::uint64_t &reported) noexcept {
+            bool written = false;
+            try {
+                auto consume = [this, &batch](const LogRing::Record &record) {
+                    if (syslogEnabled) {
+                        syslog(getPriority(record.level), "%.*s", static_cast<int>(record.length), record.text);
+                    }
+                    batch.append(record.text, record.length);
+                    batch.push_back('\n');
+                };
+                while (ring->tryPop(consume)) {
+                    written = true;
+                    if (batch.size() >= BATCH_SIZE) {
+                        writeBatch(batch);
+                    }
+                }
+                std::uint64_t lost = droppedCount();
+                if (lost != reported) {
+                    batch += getPrefix(Level::Warning) + " " + std::to_string(lost - reported) + " log records dropped\n";
+                    reported = lost;
+                }
+                writeBatch(batch);
+            } catch (...) {
+                std::cerr << getPrefix(Level::Error) + " Failed to flush log records\n";
+            }
+            return written;
+        }
+
+        void writeBatch(std::string &batch) {
+            if (batch.empty()) {
+                return;
+            }
+            logFile.write(batch.data(), static_cast<std::streamsize>(batch.size()));
+            logFile.flush();
+            batch.clear();
+        }
+
+        void stopFlusher() {
+            if (!flusher.joinable()) {
+                return;
+            }
+            {
+                std::lock_guard lock(mutex);
+                stop.store(true, std::memory_order_release);
+            }
+            wakeUp.notify_one();
+            flusher.join();
+        }
+
+        /// std::localtime shares one static buffer between all threads, so use the reentrant version
+        void formatTime(char *buffer, std::size_t size) const noexcept {
+            if (clock && size > Clock::LOG_TIME_SIZE) {
+                clock->logTime(buffer);
+                buffer[Clock::LOG_TIME_SIZE] = '\0';
+                return;
+            }
+            std::time_t result = std::time(nullptr);
+            std::tm time{};
+            localtime_r(&result, &time);
+            std::strftime(buffer, size, "%Y-%m-%d %H:%M:%S", &time);
+        }
+
+        void writeToSyslog(Level level, std::string_view message) {
+            int priority = getPriority(level);
+            char buffer[80] = {0};
+            formatTime(buffer, sizeof(buffer));
+            std::lock_guard lock(mutex);
+            syslog(priority, "%s%.*s", buffer, static_cast<int>(message.size()), message.data());
+        }
+
+        /// The stream is not flushed per record: the buffer goes out when it is full & on destruction
+        void writeToFile(Level level, std::string_view message) {
+            std::string prefix = std::move(getPrefix(level));
+            char buffer[80] = {0};
+            formatTime(buffer, sizeof(buffer));
+            std::lock_guard lock(mutex);
+            logFile << buffer << " " << prefix << " " << message << '\n';
+        }
+
+        std::mutex mutex;  // per-object, so loggers of different cores never contend
+        std::ofstream logFile;
+        const bool syslogEnabled;
+        Clock::Ptr clock;
+        std::unique_ptr<LogRing> ring;  // set in the asynchronous mode only
+        OverflowPolicy overflowPolicy = OverflowPolicy::Drop;
+        std::atomic<std::uint64_t> dropped{0};
+        std::atomic<bool> stop{false};
+        std::condition_variable wakeUp;
+        std::thread flusher;
+    };
+
+    namespace Templates::Responses {
+        /// the status line & headers only, for the bodies sent separately
+        /// @param headers - extra header lines, each ending with CRLF
+        const auto OK_HEAD = [](std::size_t content_length, const std::string &content_type = "text/html",
+                                const std::string &headers = "") {
+            return "HTTP/1.1 200 OK\r\nContent-Length: " + std::to_string(content_length) + "\r\nContent-Type: " + content_type + "\r\n" + headers + "\r\n";
+        };
+        /// The whole response in one string; the server itself sends OK_HEAD & the body with one gather write,
+        /// so that the body is never copied behind the head
+        const auto OK = [](const std::string &body = "Hello, World!", const std::string &content_type = "text/html",
+                           const std::string &headers = "") {
+            return OK_HEAD(body.length(), content_type, headers) + body;
+        };
+        /// @param headers - the validators & Vary of the representation, each ending with CRLF
+        const auto NOT_MODIFIED = [](const std::string &headers) {
+            return "HTTP/1.1 304 Not Modified\r\n" + headers + "\r\n";
+        };
+        const auto NOT_OK = [](const std::string &body = "404 Not Found!") {
+            return "HTTP/1.1 404 Not Found\r\nContent-Length: " + std::to_string(body.length()) + "\r\n\r\n" + body;
+        };
+        const auto BAD_REQUEST = [](const std::string &body = "400 Bad Request!") {
+            return "HTTP/1.1 400 Bad Request\r\nContent-Length: " + std::to_string(body.length()) + "\r\n\r\n" + body;
+        };
+        const auto TOO_LARGE = [](const std::string &body = "431 Request Header Fields Too Large!") {
+            return "HTTP/1.1 431 Request Header Fields Too Large\r\nContent-Length: " + std::to_string(body.length()) + "\r\n\r\n" + body;
+        };
+        /// the interim response to "Expect: 100-continue", sent without the Date & Connection headers
+        const auto CONTINUE = []() {
+            return std::string("HTTP/1.1 100 Continue\r\n\r\n");
+        };
+        const auto PAYLOAD_TOO_LARGE = [](const std::string &body = "413 Payload Too Large!") {
+            return "HTTP/1.1 413 Payload Too Large\r\nContent-Length: " + std::to_string(body.length()) + "\r\n\r\n" + body;
+        };
+        const auto INTERNAL_ERROR = [](const std::string &body = "500 Internal Server Error!") {
+            return "HTTP/1.1 500 Internal Server Error\r\nContent-Length: " + std::to_string(body.length()) + "\r\n\r\n" + body;
+        };
+        /// @param retry_after - the seconds the client should wait before connecting again
+        const auto SERVICE_UNAVAILABLE = [](long retry_after, const std::string &body = "503 Service Unavailable!") {
+            return "HTTP/1.1 503 Service Unavailable\r\nRetry-After: " + std::to_string(retry_after) + "\r\nContent-Length: "
+                   + std::to_string(body.length()) + "\r\n\r\n" + body;
+        };
+    }// namespace Templates::Responses
+
+    namespace Templates::Headers {
+        const std::string KEEP_ALIVE = "Connection: keep-alive\r\n";
+        const std::string CLOSE = "Connection: close\r\n";
+        /// for the responses that have compressed variants, the identity ones included
+        const std::string VARY = "Vary: Accept-Encoding\r\n";
+
+        constexpr std::size_t DATE_SIZE = 6 + Clock::HTTP_DATE_SIZE + 2;
+
+        /// @param out - receives "Date: <IMF-fixdate>\r\n", DATE_SIZE chars
+        inline void DATE(const Clock &clock, char *out) noexcept {
+            std::memcpy(out, "Date: ", 6);
+            clock.httpDate(out + 6);
+            std::memcpy(out + 6 + Clock::HTTP_DATE_SIZE, "\r\n", 2);
+        }
+    }// namespace Templates::Headers
+
+    /// Per-connection settings shared by all the sessions of a server; change them before RunServer()
+    struct SessionOptions {
+        std::size_t max_requests = 1000;               // requests served over one connection before closing it
+        std::chrono::milliseconds idle_timeout{5000};  // time to wait for the next request of a persistent connection
+        std::size_t max_header_bytes = 8192;           // the limit of the request line & headers, also the read buffer size
+        bool map_files = true;                         // serve @file: endpoints from FileStore mappings, else with sendfile
+        std::size_t max_body_bytes = 1024 * 1024;      // the default limit of a request body, see Endpoint::max_body_bytes
+        std::size_t pool_size = 256;                   // closed sessions & read buffers kept per thread for reuse
+        std::size_t max_sessions = 0;                  // concurrent sessions of a server, 0 for no limit
+        std::size_t sessions_low_water = 0;            // the limit is lifted at or below it; 0 for 90% of max_sessions
+        AdmissionPolicy admission = AdmissionPolicy::Pause;  // what happens to the connections over the limit
+        std::chrono::seconds retry_after{1};           // the Retry-After of the 503 responses of AdmissionPolicy::Reject
+    };
+
+    /// The parsed request line & headers; all the views point into the read buffer of the session
+    struct HttpRequest {
+        static constexpr std::size_t MAX_HEADERS = 64;
+
+        struct Header {
+            std::string_view name;
+            std::string_view value;
+        };
+
+        /// @param name - the header name, case-insensitive
+        /// @return the value of the first header with this name, empty if there is none
+        std::string_view header(std::string_view name) const noexcept {
+            for (std::size_t i = 0; i < headers_count; ++i) {
+                if (iequals(headers[i].name, name)) {
+                    return headers[i].value;
+                }
+            }
+            return {};
+        }
+
+        /// @param name - the header name, case-insensitive
+        /// @return how many times the header is repeated
+        std::size_t count(std::string_view name) const noexcept {
+            std::size_t count = 0;
+            for (std::size_t i = 0; i < headers_count; ++i) {
+                count += iequals(headers[i].name, name);
+            }
+            return count;
+        }
+
+        std::string_view method;
+        std::string_view target;
+        std::string_view path;   // the target before '?'
+        std::string_view query;  // the target after '?', without it
+        std::string_view version;
+        std::array<Header, MAX_HEADERS> headers;
+        std::size_t headers_count = 0;
+    };
+
+    /// Incremental zero-allocation parser of the request line & headers
+    /// Positions are kept as offsets, so the buffer may be moved (compacted) between the calls of parse()
+    class HttpRequestParser {
+    public:
+        enum class Status {
+            Complete = 0,
+            Incomplete,  // call parse() again when more bytes are read
+            BadRequest,
+            TooLarge     // more than max_header_bytes or MAX_HEADERS headers
+        };
+
+        explicit HttpRequestParser(std::size_t max_header_bytes = 8192) noexcept : max_header_bytes(max_header_bytes) {}
+
+        /// @param data - the buffered bytes, starting from the first byte of the request
+        /// @param size - the number of the buffered bytes; only the bytes after the previous call are scanned
+        /// @return Complete if the headers are over, then see request() & consumed()
+        Status parse(const char *data, std::size_t size) noexcept {
+            // the hot loop works on local copies, so they stay in registers
+            std::size_t pos = position;
+            State st = state;
+            Status status = run(data, std::min(size, max_header_bytes), pos, st);
+            position = pos;
+            state = st;
+            if (status == Status::Incomplete && position >= max_header_bytes) {
+                return Status::TooLarge;
+            }
+            return status;
+        }
+
+        /// Prepares the parser for the next request
+        void reset() noexcept {
+            state = State::Start;
+            position = 0;
+            headers_count = 0;
+        }
+
+        /// @return the parsed request; valid after parse() returned Complete & until the buffer changes
+        const HttpRequest &request() const noexcept {
+            return request_;
+        }
+
+        /// @return the size of the request line & headers, including the final empty line
+        std::size_t consumed() const noexcept {
+            return position;
+        }
+
+    private:
+        enum class State {
+            Start = 0,
+            Method,
+            TargetStart,
+            Target,
+            Version,
+            RequestLineEnd,
+            HeaderStart,
+            HeaderName,
+            HeaderValue,
+            HeaderEnd,
+            HeadersEnd
+        };
+
+        struct Span {
+            std::size_t begin;
+            std::size_t end;
+        };
+
+        struct HeaderSpan {
+            Span name;
+            Span value;
+        };
+
+        static constexpr bool isToken(char c) noexcept {
+            return TOKEN_CHARS[static_cast<unsigned char>(c)];
+        }
+
+        static constexpr bool isControl(char c) noexcept {
+            return static_cast<unsigned char>(c) < 0x20 || c == 0x7f;
+        }
+
+        static constexpr bool isSpace(char c) noexcept {
+            return c == ' ' || c == '\t';
+        }
+
+        static constexpr bool isDigit(char c) noexcept {
+            return c >= '0' && c <= '9';
+        }
+
+        /// @return true for "HTTP/" DIGIT "." DIGIT (RFC 9112 HTTP-version), nothing more
+        static bool isHttpVersion(const char *data, Span version) noexcept {
+            std::string_view value(data + version.begin, version.end - version.begin);
+            return value.size() == 8 && value.substr(0, 5) == "HTTP/" && isDigit(value[5]) && value[6] == '.' && isDigit(value[7]);
+        }
+
+        /// The state machine itself; long runs (target, header names & values) are scanned by inner loops
+        Status run(const char *data, std::size_t limit, std::size_t &pos, State &st) noexcept {
+            for (; pos < limit; ++pos) {
+                char c = data[pos];
+                switch (st) {
+                    case State::Start:  // empty lines before the request line are allowed
+                        if (c == '\r' || c == '\n') {
+                            break;
+                        }
+                        if (!isToken(c)) {
+                            return Status::BadRequest;
+                        }
+                        method = {pos, pos};
+                        st = State::Method;
+                        break;
+                    case State::Method:
+                        while (isToken(c) && pos + 1 < limit) {
+                            c = data[++pos];
+                        }
+                        if (c == ' ') {
+                            method.end = pos;
+                            st = State::TargetStart;
+                        } else if (!isToken(c)) {
+                            return Status::BadRequest;
+                        }
+                        break;
+                    case State::TargetStart:
+                        if (c == ' ' || isControl(c)) {
+                            return Status::BadRequest;
+                        }
+                        target = {pos, pos};
+                        st = State::Target;
+                        break;
+                    case State::Target:
+                        while (c != ' ' && !isControl(c) && pos + 1 < limit) {
+                            c = data[++pos];
+                        }
+                        if (c == ' ') {
+                            target.end = pos;
+                            version = {pos + 1, pos + 1};
+                            st = State::Version;
+                        } else if (isControl(c)) {
+                            return Status::BadRequest;
+                        }
+                        break;
+                    case State::Version:
+                        if (c == '\r' || c == '\n') {
+                            version.end = pos;
+                            if (!isHttpVersion(data, version)) {
+                                return Status::BadRequest;
+                            }
+                            st = c == '\r' ? State::RequestLineEnd : State::HeaderStart;
+                        } else if (isControl(c) || pos - version.begin == 8) {
+                            return Status::BadRequest;  // the version is 8 chars, whatever follows is garbage
+                        }
+                        break;
+                    case State::RequestLineEnd:
+                    case State::HeaderEnd:
+                        if (c != '\n') {
+                            return Status::BadRequest;
+                        }
+                        st = State::HeaderStart;
+                        break;
+                    case State::HeaderStart:
+                        if (c == '\r') {
+                            st = State::HeadersEnd;
+                        } else if (c == '\n') {
+                            return complete(data, pos);
+                        } else if (!isToken(c)) {
+                            return Status::BadRequest;  // includes the obsolete line folding
+                        } else if (headers_count == HttpRequest::MAX_HEADERS) {
+                            return Status::TooLarge;
+                        } else {
+                            headers[headers_count] = {{pos, pos}, {pos, pos}};
+                            st = State::HeaderName;
+                        }
+                        break;
+                    case State::HeaderName:
+                        while (isToken(c) && pos + 1 < limit) {
+                            c = data[++pos];
+                        }
+                        if (c == ':') {
+                            headers[headers_count].name.end = pos;
+                            headers[headers_count].value = {pos + 1, pos + 1};
+                            st = State::HeaderValue;
+                        } else if (!isToken(c)) {
+                            return Status::BadRequest;
+                        }
+                        break;
+                    case State::HeaderValue:
+                        while ((!isControl(c) || c == '\t') && pos + 1 < limit) {
+                            c = data[++pos];
+                        }
+                        if (c == '\r' || c == '\n') {
+                            Span &value = headers[headers_count++].value;
+                            value.end = pos;
+                            while (value.begin < value.end && isSpace(data[value.begin])) {
+                                ++value.begin;
+                            }
+                            while (value.end > value.begin && isSpace(data[value.end - 1])) {
+                                --value.end;
+                            }
+                            st = c == '\r' ? State::HeaderEnd : State::HeaderStart;
+                        } else if (isControl(c) && c != '\t') {
+                            return Status::BadRequest;
+                        }
+                        break;
+                    case State::HeadersEnd:
+                        if (c != '\n') {
+                            return Status::BadRequest;
+                        }
+                        return complete(data, pos);
+                }
+            }
+            return Status::Incomplete;
+        }
+
+        Status complete(const char *data, std::size_t &pos) noexcept {
+            ++pos;
+            auto view = [data](Span span) { return std::string_view(data + span.begin, span.end - span.begin); };
+            request_.method = view(method);
+            request_.target = view(target);
+            std::size_t query = request_.target.find('?');
+            request_.path = request_.target.substr(0, query);
+            request_.query = query != std::string_view::npos ? request_.target.substr(query + 1) : std::string_view();
+            request_.version = view(version);
+            for (std::size_t i = 0; i < headers_count; ++i) {
+                request_.headers[i] = {view(headers[i].name), view(headers[i].value)};
+            }
+            request_.headers_count = headers_count;
+            return Status::Complete;
+        }
+
+        const std::size_t max_header_bytes;
+        State state = State::Start;
+        std::size_t position = 0;
+        Span method{};
+        Span target{};
+        Span version{};
+        std::array<HeaderSpan, HttpRequest::MAX_HEADERS> headers{};
+        std::size_t headers_count = 0;
+        HttpRequest request_;
+    };
+
+    /// Incremental decoder of a request body framed by Content-Length or by the chunked transfer coding;
+    /// decodes in place: the body bytes are moved to the front of the data, the framing is dropped
+    class BodyDecoder {
+    public:
+        enum class Status {
+            Complete,    // the whole body is decoded, the rest of the data belongs to the next request
+            Incomplete,  // all the data is used, more is needed
+            BadRequest,
+            TooLarge     // the body exceeds the limit
+        };
+
+        /// @param content_length - the body size, ignored if chunked
+        /// @param limit - the maximum number of body bytes
+        void reset(std::size_t content_length, bool chunked, std::size_t limit) noexcept {
+            this->chunked = chunked;
+            this->limit = limit;
+            received = 0;
+            digits = 0;
+            remaining = chunked ? 0 : content_length;
+            state = chunked ? State::Size : (content_length > 0 ? State::Data : State::Done);
+        }
+
+        /// @param data - the raw bytes, overwritten by the decoded ones
+        /// @param consumed - the number of raw bytes used
+        /// @param produced - the number of body bytes now at the front of data
+        Status decode(char *data, std::size_t size, std::size_t &consumed, std::size_t &produced) noexcept {
+            std::size_t pos = 0;
+            produced = 0;
+            Status status = run(data, size, pos, produced);
+            consumed = pos;
+            return status;
+        }
+
+        bool isChunked() const noexcept { return chunked; }
+        std::size_t maxSize() const noexcept { return limit; }
+        std::size_t receivedSize() const noexcept { return received; }
+        /// @return the body bytes still expected, for Content-Length bodies
+        std::size_t remainingSize() const noexcept { return remaining; }
+
+    private:
+        enum class State {
+            Size,        // chunk-size, hex
+            Extension,   // ;chunk-ext, skipped
+            SizeLF,
+            Data,
+            DataCR,
+            DataLF,
+            Trailer,     // the start of a trailer line or the final CRLF
+            TrailerLine,
+            TrailerLF,
+            Done
+        };
+
+        static int hexValue(char c) noexcept {
+            if (c >= '0' && c <= '9') {
+                return c - '0';
+            }
+            c = toLower(c);
+            return c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
+        }
+
+        Status run(char *data, std::size_t size, std::size_t &pos, std::size_t &produced) noexcept {
+            while (pos < size) {
+                char c = data[pos];
+                switch (state) {
+                    case State::Data: {
+                        std::size_t n = std::min(remaining, size - pos);
+                        if (data + produced != data + pos) {
+                            std::memmove(data + produced, data + pos, n);
+                        }
+                        produced += n;
+                        pos += n;
+                        remaining -= n;
+                        received += n;
+                        if (remaining == 0) {
+                            if (!chunked) {
+                                state = State::Done;
+                                return Status::Complete;
+                            }
+                            state = State::DataCR;
+                        }
+                        continue;
+                    }
+                    case State::Size: {
+                        int value = hexValue(c);
+                        if (value >= 0) {
+                            if (++digits > 2 * sizeof(std::size_t)) {
+                                return Status::TooLarge;
+                            }
+                            remaining = remaining * 16 + value;
+                        } else if (digits == 0) {
+                            return Status::BadRequest;
+                        } else if (c == ';' || c == ' ' || c == '\t') {
+                            state = State::Extension;
+                        } else if (c == '\r') {
+                            state = State::SizeLF;
+                        } else {
+                            return Status::BadRequest;
+                        }
+                        break;
+                    }
+                    case State::Extension:
+                        if (c == '\r') {
+                            state = State::SizeLF;
+                        }
+                        break;
+                    case State::SizeLF:
+                        if (c != '\n') {
+                            return Status::BadRequest;
+                        }
+                        if (remaining == 0) {
+                            state = State::Trailer;
+                        } else if (remaining > limit - received) {
+                            return Status::TooLarge;
+                        } else {
+                            state = State::Data;
+                        }
+                        break;
+                    case State::DataCR:
+                        if (c != '\r') {
+                            return Status::BadRequest;
+                        }
+                        state = State::DataLF;
+                        break;
+                    case State::DataLF:
+                        if (c != '\n') {
+                            return Status::BadRequest;
+                        }
+                        digits = 0;
+                        state = State::Size;
+                        break;
+                    case State::Trailer:
+                        state = c == '\r' ? State::TrailerLF : State::TrailerLine;
+                        break;
+                    case State::TrailerLine:
+                        if (c == '\n') {
+                            state = State::Trailer;
+                        }
+                        break;
+                    case State::TrailerLF:
+                        if (c != '\n') {
+                            return Status::BadRequest;
+                        }
+                        ++pos;
+                        state = State::Done;
+                        return Status::Complete;
+                    case State::Done:
+                        return Status::Complete;
+                }
+                ++pos;
+            }
+            return state == State::Done ? Status::Complete : Status::Incomplete;
+        }
+
+        State state = State::Done;
+        bool chunked = false;
+        std::size_t limit = 0;
+        std::size_t received = 0;   // body bytes decoded so far
+        std::size_t remaining = 0;  // body bytes left in the current chunk or in the Content-Length body
+        std::size_t digits = 0;
+    };
+
+    namespace {
+        /// @return false if the file ended before size bytes or can not be read
+        bool readAll(int fd, char *out, std::size_t size) noexcept {
+            std::size_t done = 0;
+            while (done < size) {
+                ssize_t length = ::pread(fd, out + done, size - done, static_cast<off_t>(done));
+                if (length > 0) {
+                    done += static_cast<std::size_t>(length);
+                } else if (length == 0 || errno != EINTR) {
+                    return false;
+                }
+            }
+            return true;
+        }
+    }// namespace
+
+    /// The weak ETag of a file, W/"<size>-<mtime>" in hex: built from what stat said, so the data is never read
+    /// for it, & on the stack, so checking the validators of a request costs no allocation
+    class FileTag {
+    public:
+        FileTag(std::size_t size, const timespec &modified) noexcept {
+            char *end = text.data();
+            std::memcpy(end, "W/\"", 3);
+            end = std::to_chars(end + 3, end + 3 + 16, size, 16).ptr;
+            *end++ = '-';
+            end = std::to_chars(end, end + 16, static_cast<std::uint64_t>(modified.tv_sec), 16).ptr;
+            *end++ = '.';
+            end = std::to_chars(end, end + 16, static_cast<std::uint64_t>(modified.tv_nsec), 16).ptr;
+            *end++ = '"';
+            length = static_cast<std::size_t>(end - text.data());
+        }
+
+        std::string_view etag() const noexcept {
+            return std::string_view(text.data(), length);
+        }
+
+        /// @return the opaque part, shared by the tags of the compressed variants
+        std::string_view version() const noexcept {
+            return etag().substr(3, length - 4);
+        }
+
+    private:
+        std::array<char, 3 * 16 + 6> text;
+        std::size_t length;
+    };
+
+    /// An opened file sent as a response body with sendfile(2): the data goes from the page cache to the socket
+    /// Owns the descriptor, move-only
+    class FileBody {
+    public:
+        FileBody() noexcept = default;
+
+        /// @param filename - the file to open; check operator bool() for success
+        explicit FileBody(const std::string &filename) noexcept : fd(::open(filename.c_str(), O_RDONLY | O_CLOEXEC)) {
+            struct stat info{};
+            bool opened = fd >= 0 && ::fstat(fd, &info) == 0;
+            if (opened && S_ISREG(info.st_mode)) {
+                size = static_cast<std::size_t>(info.st_size);
+                modified_ = info.st_mtim;
+            } else {
+                error_ = opened ? EINVAL : errno;  // not a regular file or the errno of open/fstat
+                reset();
+            }
+        }
+
+        FileBody(FileBody &&other) noexcept
+                : fd(other.fd), size(other.size), offset(other.offset), modified_(other.modified_), error_(other.error_) {
+            other.fd = -1;
+        }
+
+        FileBody &operator=(FileBody &&other) noexcept {
+            if (this != &other) {
+                reset();
+                std::swap(fd, other.fd);
+                size = other.size;
+                offset = other.offset;
+                modified_ = other.modified_;
+                error_ = other.error_;
+            }
+            return *this;
+        }
+
+        ~FileBody() {
+            reset();
+        }
+
+        explicit operator bool() const noexcept {
+            return fd >= 0;
+        }
+
+        /// @return why the file could not be opened, an errno value; 0 if it is opened
+        int error() const noexcept {
+            return error_;
+        }
+
+        /// Sends the next part of the file into a non-blocking socket
+        /// @return false with errno set if nothing was sent (EAGAIN: wait until the socket is writable)
+        bool sendTo(int socket) noexcept {
+            ssize_t sent = ::sendfile(socket, fd, &offset, size - static_cast<std::size_t>(offset));
+            if (sent == 0) {
+                errno = EIO;  // the file was truncated after it was opened
+            }
+            return sent > 0;
+        }
+
+        bool done() const noexcept {
+            return static_cast<std::size_t>(offset) >= size;
+        }
+
+        std::size_t length() const noexcept {
+            return size;
+        }
+
+        /// @return the modification time of the file when it was opened
+        const timespec &modified() const noexcept {
+            return modified_;
+        }
+
+        /// Reads the whole file, whatever has been sent of it
+        /// @return false if the file is shorter than length() by now or can not be read
+        bool read(std::string &out) const {
+            out.resize(size);
+            return readAll(fd, out.data(), size);
+        }
+
+    private:
+        void reset() noexcept {
+            if (fd >= 0) {
+                ::close(fd);
+                fd = -1;
+            }
+        }
+
+        int fd = -1;
+        std::size_t size = 0;
+        off_t offset = 0;
+        timespec modified_{};
+        int error_ = 0;
+    };
+
+    namespace StaticHash {
+        /// FNV-1a, the only pass over the path during a lookup
+        constexpr std::uint64_t hash(std::string_view key) noexcept {
+            std::uint64_t hash = 14695981039346656037ULL;
+            for (char c : key) {
+                hash = (hash ^ static_cast<unsigned char>(c)) * 1099511628211ULL;
+            }
+            return hash;
+        }
+
+        /// The key of a route: the path followed by the method as one more byte
+        constexpr std::uint64_t hash(std::string_view path, Method method) noexcept {
+            return (hash(path) ^ (static_cast<std::uint64_t>(method) + 1)) * 1099511628211ULL;
+        }
+
+        /// splitmix64 finalizer: a new slot for every displacement without rehashing the path
+        constexpr std::uint64_t mix(std::uint64_t hash, std::uint64_t displacement) noexcept {
+            std::uint64_t x = hash ^ (displacement * 0x9e3779b97f4a7c15ULL);
+            x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+            x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+            return x ^ (x >> 31);
+        }
+
+        constexpr std::size_t slotsFor(std::size_t routes) noexcept {
+            std::size_t slots = 1;
+            while (slots < routes) {
+                slots <<= 1;
+            }
+            return slots;
+        }
+
+        /// The hash-and-displace step shared by the compile-time table & its runtime copy
+        /// @param displacement - the displacement of the bucket of the hash
+        /// @return the only slot the route may occupy
+        constexpr std::size_t slot(std::uint64_t hash, std::int32_t displacement, std::size_t mask) noexcept {
+            return displacement < 0 ? static_cast<std::size_t>(-displacement - 1) : mix(hash, displacement) & mask;
+        }
+    }// namespace StaticHash
+
+    /// A read-only memory mapping holding a private snapshot of a whole file; responses hold it until they are
+    /// sent, so a replaced mapping is unmapped only when nobody uses it
+    /// The file is read into anonymous memory rather than mapped with MAP_SHARED: a shared mapping shows the writes
+    /// of others under a stale Content-Length & raises SIGBUS once the file shrinks (MAP_PRIVATE alone keeps reading
+    /// the shared pages until they are written). A file rewritten in place may be caught half-written: it is read
+    /// again when the writer closes it, so replace files by rename for atomic updates
+    class FileMapping {
+    public:
+        typedef std::shared_ptr<const FileMapping> Ptr;
+
+        /// @return the snapshot of the file or nullptr if it can not be read, e.g. it shrank while being read
+        static Ptr map(const std::string &filename) noexcept {
+            int fd = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd < 0) {
+                return nullptr;
+            }
+            struct stat info{};
+            Ptr mapping;
+            if (::fstat(fd, &info) == 0 && S_ISREG(info.st_mode)) {
+                auto size = static_cast<std::size_t>(info.st_size);
+                void *data = size > 0 ? ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0) : nullptr;
+                if (data != MAP_FAILED) {
+                    if (readAll(fd, static_cast<char *>(data), size) && (size == 0 || ::mprotect(data, size, PROT_READ) == 0)) {
+                        mapping.reset(new(std::nothrow) FileMapping(static_cast<const char *>(data), size, info.st_mtim));
+                    }
+                    if (!mapping && data != nullptr) {
+                        ::munmap(data, size);
+                    }
+                }
+            }
+            ::close(fd);
+            return mapping;
+        }
+
+        FileMapping(const FileMapping &) = delete;
+        FileMapping &operator=(const FileMapping &) = delete;
+
+        ~FileMapping() {
+            if (data_ != nullptr) {
+                ::munmap(const_cast<char *>(data_), size_);
+            }
+        }
+
+        const char *data() const noexcept {
+            return data_;
+        }
+
+        std::size_t size() const noexcept {
+            return size_;
+        }
+
+        /// @return the modification time of the file when it was read
+        std::time_t modified() const noexcept {
+            return modified_.tv_sec;
+        }
+
+        /// @return the opaque part of the weak ETag of the file, see FileTag
+        std::string version() const {
+            return std::string(FileTag(size_, modified_).version());
+        }
+
+    private:
+        FileMapping(const char *data, std::size_t size, timespec modified) noexcept
+                : data_(data), size_(size), modified_(modified) {}
+
+        const char *data_;
+        std::size_t size_;
+        timespec modified_;
+    };
+
+    namespace Compression {
+        /// The content codings of the precompressed variants, in the order of preference
+        enum Coding {
+            Brotli = 0,
+            Zstd,
+            Gzip,
+            CODINGS_COUNT
+        };
+        constexpr int IDENTITY = -1;
+        constexpr std::array<std::string_view, CODINGS_COUNT> NAMES{"br", "zstd", "gzip"};
+        constexpr std::array<std::string_view, CODINGS_COUNT> SUFFIXES{".br", ".zst", ".gz"};  // of the sibling files
+        constexpr std::size_t MAX_BODY = 256 * 1024;  // bigger bodies are compressed by their sibling files only
+
+        /// Compresses at the highest level: it runs once per body, never on the request path
+        /// @return the compressed data, empty if the coding is not compiled in or fails
+        inline std::string compress(Coding coding, [[maybe_unused]] std::string_view data) {
+            std::string out;
+            switch (coding) {
+                case Brotli: {
+#ifdef SERVEME_WITH_BROTLI
+                    std::size_t size = BrotliEncoderMaxCompressedSize(data.size());
+                    out.resize(size);
+                    if (size == 0 || !BrotliEncoderCompress(BROTLI_MAX_QUALITY, BROTLI_DEFAULT_WINDOW, BROTLI_MODE_GENERIC, data.size(),
+                                                            reinterpret_cast<const std::uint8_t *>(data.data()), &size,
+                                                            reinterpret_cast<std::uint8_t *>(out.data()))) {
+                        return {};
+                    }
+                    out.resize(size);
+#endif
+                    break;
+                }
+                case Zstd: {
+#ifdef SERVEME_WITH_ZSTD
+                    out.resize(ZSTD_compressBound(data.size()));
+                    std::size_t size = ZSTD_compress(out.data(), out.size(), data.data(), data.size(), 19);
+                    if (ZSTD_isError(size)) {
+                        return {};
+                    }
+                    out.resize(size);
+#endif
+                    break;
+                }
+                case Gzip: {
+#ifdef SERVEME_WITH_ZLIB
+                    z_stream stream{};
+                    if (deflateInit2(&stream, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 9, Z_DEFAULT_STRATEGY) != Z_OK) {
+                        return {};
+                    }
+                    out.resize(deflateBound(&stream, data.size()));
+                    stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data.data()));
+                    stream.avail_in = static_cast<uInt>(data.size());
+                    stream.next_out = reinterpret_cast<Bytef *>(out.data());
+                    stream.avail_out = static_cast<uInt>(out.size());
+                    int result = deflate(&stream, Z_FINISH);
+                    out.resize(stream.total_out);
+                    deflateEnd(&stream);
+                    if (result != Z_STREAM_END) {
+                        return {};
+                    }
+#endif
+                    break;
+                }
+                default:
+                    break;
+            }
+            return out;
+        }
+
+        /// @param value - a qvalue: "0", "0.5", "1.000", ...
+        /// @return the value in thousandths, 1000 if malformed
+        inline int parseQuality(std::string_view value) noexcept {
+            if (value.empty() || (value[0] != '0' && value[0] != '1')) {
+                return 1000;
+            }
+            int quality = (value[0] - '0') * 1000;
+            if (value.size() > 2 && value[1] == '.') {
+                int scale = 100;
+                for (std::size_t i = 2; i < value.size() && i < 5 && value[i] >= '0' && value[i] <= '9'; ++i, scale /= 10) {
+                    quality += (value[i] - '0') * scale;
+                }
+            }
+            return std::min(quality, 1000);
+        }
+
+        /// @param accept_encoding - the Accept-Encoding header, e.g. "gzip, deflate, br;q=0.9"
+        /// @param available - the bit mask of the codings that have a variant
+        /// @return the acceptable coding of the highest qvalue, the preferred one among equal; IDENTITY if none
+        inline int negotiate(std::string_view accept_encoding, unsigned available) noexcept {
+            if (accept_encoding.empty() || available == 0) {
+                return IDENTITY;
+            }
+            std::array<int, CODINGS_COUNT> qualities;
+            qualities.fill(-1);
+            int any = -1;
+            while (!accept_encoding.empty()) {
+                std::size_t comma = accept_encoding.find(',');
+                std::string_view item = accept_encoding.substr(0, comma);
+                accept_encoding = comma == std::string_view::npos ? std::string_view() : accept_encoding.substr(comma + 1);
+                std::size_t semicolon = item.find(';');
+                std::string_view name = trim(item.substr(0, semicolon));
+                int quality = 1000;
+                if (semicolon != std::string_view::npos) {
+                    std::string_view parameter = trim(item.substr(semicolon + 1));
+                    if (parameter.size() > 2 && toLower(parameter[0]) == 'q' && parameter[1] == '=') {
+                        quality = parseQuality(parameter.substr(2));
+                    }
+                }
+                if (name == "*") {
+                    any = quality;
+                } else if (iequals(name, "x-gzip")) {
+                    qualities[Gzip] = quality;
+                } else {
+                    for (std::size_t i = 0; i < CODINGS_COUNT; ++i) {
+                        if (iequals(name, NAMES[i])) {
+                            qualities[i] = quality;
+                        }
+                    }
+                }
+            }
+            int best = IDENTITY, best_quality = 0;
+            for (int i = 0; i < CODINGS_COUNT; ++i) {
+                int quality = qualities[i] >= 0 ? qualities[i] : any;
+                if ((available & (1u << i)) && quality > best_quality) {
+                    best = i;
+                    best_quality = quality;
+                }
+            }
+            return best;
+        }
+    }// namespace Compression
+
+    /// The compressed variants of one body, only those smaller than the body are kept
+    class EncodedBody {
+    public:
+        typedef std::shared_ptr<const EncodedBody> Ptr;
+
+        /// Compresses the data once per process: equal bodies of all the endpoints & shards share the variants
+        static Ptr of(std::string_view data) {
+            static std::mutex mutex;
+            // the hash only narrows the search, a hit is compared in full, so colliding bodies never share variants
+            static std::multimap<std::pair<std::uint64_t, std::size_t>, std::weak_ptr<const EncodedBody>> bodies;
+            static std::size_t sweep_at = 64;
+            std::pair<std::uint64_t, std::size_t> key(StaticHash::hash(data), data.size());
+            Ptr body;
+            {
+                std::lock_guard lock(mutex);
+                auto [first, last] = bodies.equal_range(key);
+                for (auto it = first; it != last && !body;) {
+                    if (Ptr found = it->second.lock(); !found) {
+                        it = bodies.erase(it);
+                    } else if (found->source == data) {
+                        body = std::move(found);
+                    } else {
+                        ++it;
+                    }
+                }
+                if (!body) {
+                    auto created = std::make_shared<EncodedBody>();
+                    created->source.assign(data);
+                    bodies.emplace(key, created);
+                    body = std::move(created);
+                    // the other keys are swept lazily: once the map doubles since the last sweep
+                    if (bodies.size() >= sweep_at) {
+                        for (auto it = bodies.begin(); it != bodies.end();) {
+                            it = it->second.expired() ? bodies.erase(it) : std::next(it);
+                        }
+                        sweep_at = std::max<std::size_t>(64, 2 * bodies.size());
+                    }
+                }
+            }
+            // compressed outside the lock by the first caller, the concurrent callers of the same body wait for it
+            std::call_once(body->compressed, [&body] {
+                for (int coding = 0; coding < Compression::CODINGS_COUNT; ++coding) {
+                    std::string compressed = Compression::compress(static_cast<Compression::Coding>(coding), body->source);
+                    if (!compressed.empty() && compressed.size() < body->source.size()) {
+                        body->variants[coding] = std::move(compressed);
+                    }
+                }
+            });
+            return body;
+        }
+
+        /// @return the compressed data, empty if the coding does not pay off
+        std::string_view variant(int coding) const noexcept {
+            return variants[coding];
+        }
+
+    private:
+        std::string source;  // the identity data, at most Compression::MAX_BODY: compared on every hit
+        mutable std::once_flag compressed;
+        mutable std::array<std::string, Compression::CODINGS_COUNT> variants;  // written once under compressed
+    };
+
+    /// The representations of a response body: the identity one & the compressed variants, chosen per request
+    /// by Accept-Encoding, with their prebuilt heads, validators (ETag, Last-Modified) & 304 responses
+    class EncodedVariants {
+    public:
+        /// @param body - the identity body; compressed in memory unless it is bigger than Compression::MAX_BODY
+        /// @param siblings - the precompressed files of the codings, they are preferred; may be nullptr
+        /// @param last_modified - the time for Last-Modified & If-Modified-Since, 0 if unknown
+        /// @param version - the opaque part of a weak ETag, e.g. FileMapping::version(); empty for a strong one
+        ///                  hashing the body
+        void build(std::string_view body, const std::string &content_type,
+                   const std::array<FileMapping::Ptr, Compression::CODINGS_COUNT> &siblings = {},
+                   std::time_t last_modified = 0, const std::string &version = "") {
+            available = 0;
+            this->siblings = siblings;
+            this->last_modified = last_modified;
+            compressed = body.size() <= Compression::MAX_BODY ? EncodedBody::of(body) : nullptr;
+            for (int coding = 0; coding < Compression::CODINGS_COUNT; ++coding) {
+                bodies[coding] = siblings[coding] ? std::string_view(siblings[coding]->data(), siblings[coding]->size())
+                                                  : (compressed ? compressed->variant(coding) : std::string_view());
+                if (!bodies[coding].empty()) {
+                    available |= 1u << coding;
+                }
+            }
+            // a tag per representation: the content hash (strong) or the version (weak) & the coding
+            std::string tag = version;
+            if (tag.empty()) {
+                char hash[16];
+                std::uint64_t value = StaticHash::hash(body);
+                for (int i = 15; i >= 0; --i, value >>= 4) {
+                    hash[i] = "0123456789abcdef"[value & 15];
+                }
+                tag.assign(hash, sizeof(hash));
+            }
+            std::string_view weak = version.empty() ? "" : "W/";
+            std::string vary = available != 0 ? Templates::Headers::VARY : "";
+            for (int coding = Compression::IDENTITY; coding < Compression::CODINGS_COUNT; ++coding) {
+                std::size_t i = coding + 1;
+                if (coding != Compression::IDENTITY && bodies[coding].empty()) {
+                    heads[i].clear();
+                    etags[i].clear();
+                    not_modified[i].clear();
+                    continue;
+                }
+                bool identity = coding == Compression::IDENTITY;
+                etags[i] = std::string(weak) + "\"" + tag + (identity ? "" : "-" + std::string(Compression::NAMES[coding])) + "\"";
+                std::string validators = vary + validatorHeaders(etags[i], last_modified);
+                heads[i] = Templates::Responses::OK_HEAD(identity ? body.size() : bodies[coding].size(), content_type,
+                                                         (identity ? "" : "Content-Encoding: " + std::string(Compression::NAMES[coding]) + "\r\n")
+                                                         + validators);
+                not_modified[i] = Templates::Responses::NOT_MODIFIED(validators);
+            }
+        }
+
+        /// @return the coding to send or Compression::IDENTITY
+        int choose(std::string_view accept_encoding) const noexcept {
+            return available != 0 ? Compression::negotiate(accept_encoding, available) : Compression::IDENTITY;
+        }
+
+        /// @return true if there are no compressed variants
+        bool empty() const noexcept {
+            return available == 0;
+        }
+
+        /// @return true if the client already has the representation: If-None-Match matches its ETag or,
+        ///         without If-None-Match, it is not modified since If-Modified-Since
+        bool fresh(const HttpRequest &request, int coding) const noexcept {
+            return fresh(request, etags[coding + 1], last_modified);
+        }
+
+        /// @param etag - the current tag of the representation, weak or strong
+        /// @param last_modified - 0 if unknown
+        static bool fresh(const HttpRequest &request, std::string_view etag, std::time_t last_modified) noexcept {
+            std::string_view if_none_match = request.header("If-None-Match");
+            if (!if_none_match.empty()) {
+                if (etag.substr(0, 2) == "W/") {
+                    etag.remove_prefix(2);
+                }
+                while (!if_none_match.empty()) {
+                    std::size_t comma = if_none_match.find(',');
+                    std::string_view tag = trim(if_none_match.substr(0, comma));
+                    if_none_match = comma == std::string_view::npos ? std::string_view() : if_none_match.substr(comma + 1);
+                    if (tag.substr(0, 2) == "W/") {
+                        tag.remove_prefix(2);  // If-None-Match compares weakly
+                    }
+                    if (tag == "*" || tag == etag) {
+                        return true;
+                    }
+                }
+                return false;
+            }
+            std::string_view if_modified_since = request.header("If-Modified-Since");
+            std::time_t since = 0;
+            return last_modified != 0 && !if_modified_since.empty()
+                   && Clock::parseHttpDate(if_modified_since, since) && last_modified <= since;
+        }
+
+        /// @param last_modified - 0 for no Last-Modified
+        /// @return the ETag & Last-Modified header lines
+        static std::string validatorHeaders(std::string_view etag, std::time_t last_modified) {
+            std::string headers = "ETag: " + std::string(etag) + "\r\n";
+            if (last_modified != 0) {
+                char date[Clock::HTTP_DATE_SIZE];
+                Clock::formatHttpDate(last_modified, date);
+                headers.append("Last-Modified: ").append(date, sizeof(date)).append("\r\n");
+            }
+            return headers;
+        }
+
+        /// The status line & headers of the representation, the identity one included
+        const std::string &head(int coding) const noexcept {
+            return heads[coding + 1];
+        }
+
+        /// The 304 response of the representation
+        const std::string &notModified(int coding) const noexcept {
+            return not_modified[coding + 1];
+        }
+
+        /// @param coding - a compressed one; the identity body is kept by the owner
+        std::string_view body(int coding) const noexcept {
+            return bodies[coding];
+        }
+
+        /// @return the bytes of the heads, the 304 responses & the compressed variants
+        std::size_t size() const noexcept {
+            std::size_t bytes = 0;
+            for (std::size_t i = 0; i < heads.size(); ++i) {
+                bytes += heads[i].size() + etags[i].size() + not_modified[i].size();
+            }
+            for (std::string_view body : bodies) {
+                bytes += body.size();
+            }
+            return bytes;
+        }
+
+    private:
+        unsigned available = 0;
+        std::time_t last_modified = 0;
+        // indexed by coding + 1, the identity representation first
+        std::array<std::string, Compression::CODINGS_COUNT + 1> heads;
+        std::array<std::string, Compression::CODINGS_COUNT + 1> etags;
+        std::array<std::string, Compression::CODINGS_COUNT + 1> not_modified;
+        std::array<std::string_view, Compression::CODINGS_COUNT> bodies;  // point into compressed or siblings
+        EncodedBody::Ptr compressed;
+        std::array<FileMapping::Ptr, Compression::CODINGS_COUNT> siblings;
+    };
+
+    /// A @file: target as it is served: the mapping & its representations
+    struct MappedFile {
+        typedef std::shared_ptr<const MappedFile> Ptr;
+
+        /// Maps the file & its sibling filename.br/.zst/.gz files, the siblings older than the file are ignored;
+        /// the ETag is weak, of the size & modification time: a big file is not hashed on every change
+        /// Loaded once per process: the FileStores of all the shards share the snapshot & its compressed variants
+        /// while none of the files has changed; concurrent loads of the same file wait for the first one
+        /// @return nullptr if the file can not be mapped
+        static Ptr load(const std::string &filename) {
+            static std::mutex mutex;
+            static std::map<std::string, std::unique_ptr<Loaded>, std::less<>> loaded;  // one per @file: target
+            Loaded *slot;
+            {
+                std::lock_guard lock(mutex);
+                auto &entry = loaded[filename];
+                if (!entry) {
+                    entry = std::make_unique<Loaded>();
+                }
+                slot = entry.get();
+            }
+            std::lock_guard lock(slot->mutex);
+            std::string identity = identify(filename);
+            if (Ptr file = slot->file.lock(); file && !identity.empty() && file->identity == identity) {
+                return file;
+            }
+            Ptr file = read(filename, std::move(identity));
+            slot->file = file;
+            return file;
+        }
+
+        std::string_view body() const noexcept {
+            return std::string_view(mapping->data(), mapping->size());
+        }
+
+        FileMapping::Ptr mapping;
+        EncodedVariants encoded;
+        std::string identity;  // the versions of the file & its siblings before they were read, see identify()
+
+    private:
+        struct Loaded {
+            std::mutex mutex;
+            std::weak_ptr<const MappedFile> file;
+        };
+
+        /// @return the versions of the file & its siblings as stat(2) sees them; empty if the file is missing
+        static std::string identify(const std::string &filename) {
+            std::string identity;
+            struct stat info{};
+            if (::stat(filename.c_str(), &info) != 0) {
+                return identity;
+            }
+            identity = FileTag(static_cast<std::size_t>(info.st_size), info.st_mtim).version();
+            for (std::string_view suffix : Compression::SUFFIXES) {
+                identity += ' ';
+                if (::stat((filename + std::string(suffix)).c_str(), &info) == 0) {
+                    identity += FileTag(static_cast<std::size_t>(info.st_size), info.st_mtim).version();
+                }
+            }
+            return identity;
+        }
+
+        static Ptr read(const std::string &filename, std::string identity) {
+            FileMapping::Ptr mapping = FileMapping::map(filename);
+            if (!mapping) {
+                return nullptr;
+            }
+            auto file = std::make_shared<MappedFile>();
+            std::array<FileMapping::Ptr, Compression::CODINGS_COUNT> siblings;
+            for (int coding = 0; coding < Compression::CODINGS_COUNT; ++coding) {
+                siblings[coding] = FileMapping::map(filename + std::string(Compression::SUFFIXES[coding]));
+                if (siblings[coding] && siblings[coding]->modified() < mapping->modified()) {
+                    siblings[coding] = nullptr;
+                }
+            }
+            file->encoded.build(std::string_view(mapping->data(), mapping->size()), "text/html", siblings, mapping->modified(),
+                                mapping->version());
+            file->mapping = std::move(mapping);
+            file->identity = std::move(identity);
+            return file;
+        }
+    };
+
+    /// Thread-safe LRU cache of the responses, keyed by (method, path) & bounded by a byte budget
+    /// Entries are spread between independently locked shards by the key hash to cut lock contention;
+    /// the values are immutable & refcounted, so a hit is sent to the socket without copying
+    class Cache {
+    public:
+        /// A response read from a file: a prebuilt head & the body or its compressed variant go out with one gather
+        /// write, never concatenated
+        struct Response {
+            std::string body;          // the identity one
+            EncodedVariants encoded;   // the heads, 304 responses & compressed variants, with the validators of the file
+            std::size_t size = 0;  // the size & modification time of the file, to tell if it has changed since
+            timespec modified{};
+
+            /// @param info - the current state of the file
+            bool matches(const struct stat &info) const noexcept {
+                return size == static_cast<std::size_t>(info.st_size) && modified.tv_sec == info.st_mtim.tv_sec
+                       && modified.tv_nsec == info.st_mtim.tv_nsec;
+            }
+        };
+
+        typedef std::shared_ptr<const Response> Value;
+
+        /// @param capacity - the byte budget of the whole cache (bodies & keys)
+        /// @param shards_count - the number of independently locked parts; use 1 if there is only one thread
+        explicit Cache(std::size_t capacity = 64 * 1024 * 1024, std::size_t shards_count = 16)
+                : shards(std::max<std::size_t>(shards_count, 1)) {
+            setCapacity(capacity);
+        }
+
+        /// @return the cached response or nullptr; a hit makes the entry the most recently used
+        Value get(std::string_view method, std::string_view path) {
+            Key key{method, path};
+            Shard &shard = shardFor(key);
+            std::lock_guard lock(shard.mutex);
+            auto it = shard.index.find(key);
+            if (it == shard.index.end()) {
+                return nullptr;
+            }
+            shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+            return it->second->value;
+        }
+
+        /// @param value - the response to cache; it replaces an already cached one (e.g. of a changed file),
+        ///                a value larger than the budget of a shard is not cached at all
+        void put(std::string_view method, std::string_view path, Value value) {
+            Key key{method, path};
+            Shard &shard = shardFor(key);
+            std::size_t size = entrySize(method, path, *value);
+            std::lock_guard lock(shard.mutex);
+            auto it = shard.index.find(key);
+            if (it != shard.index.end()) {
+                shard.bytes -= it->second->size;
+                std::list<Entry>::iterator entry = it->second;
+                shard.index.erase(it);  // the key views into the entry
+                shard.lru.erase(entry);
+            }
+            if (size > shard.capacity) {
+                return;
+            }
+            shard.lru.push_front({std::string(method), std::string(path), std::move(value), size});
+            const Entry &entry = shard.lru.front();
+            shard.index.emplace(Key{entry.method, entry.path}, shard.lru.begin());
+            shard.bytes += size;
+            evict(shard);
+        }
+
+        /// @param capacity - the new byte budget of the whole cache; extra entries are evicted at once
+        void setCapacity(std::size_t capacity) {
+            for (Shard &shard : shards) {
+                std::lock_guard lock(shard.mutex);
+                shard.capacity = capacity / shards.size();
+                evict(shard);
+            }
+        }
+
+    private:
+        struct Entry {
+            std::string method;
+            std::string path;
+            Value value;
+            std::size_t size;
+        };
+
+        /// Views into the Entry itself (list nodes never move), or into the request for lookups
+        struct Key {
+            std::string_view method;
+            std::string_view path;
+
+            bool operator==(const Key &other) const noexcept {
+                return method == other.method && path == other.path;
+            }
+        };
+
+        struct KeyHash {
+            std::size_t operator()(const Key &key) const noexcept {
+                std::size_t hash = std::hash<std::string_view>()(key.path);
+                return hash ^ (std::hash<std::string_view>()(key.method) + 0x9e3779b97f4a7c15ULL + (hash << 6) + (hash >> 2));
+            }
+        };
+
+        struct alignas(64) Shard {  // one cache line per shard head, so the locks do not share lines
+            std::mutex mutex;
+            std::list<Entry> lru;  // the most recently used first
+            std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> index;
+            std::size_t bytes = 0;
+            std::size_t capacity = 0;
+        };
+
+        static std::size_t entrySize(std::string_view method, std::string_view path, const Response &value) noexcept {
+            constexpr std::size_t overhead = sizeof(Entry) + sizeof(Response) + 64;  // list & hash nodes
+            return method.size() + path.size() + value.body.size() + value.encoded.size() + overhead;
+        }
+
+        Shard &shardFor(const Key &key) noexcept {
+            return shards[KeyHash()(key) % shards.size()];
+        }
+
+        static void evict(Shard &shard) {
+            while (shard.bytes > shard.capacity && !shard.lru.empty()) {
+                const Entry &entry = shard.lru.back();
+                shard.bytes -= entry.size;
+                shard.index.erase(Key{entry.method, entry.path});
+                shard.lru.pop_back();
+                Metrics::local().cache_evictions.add();
+            }
+        }
+
+        std::vector<Shard> shards;
+    };
+
+    /// Memory-mapped @file: targets, snapshotted once & refreshed when inotify reports a change of the file
+    /// The directories are watched, not the files, so editors replacing a file by rename are noticed too
+    /// A changed file is read & compressed by a background loader, never on the io_context: the reactor only
+    /// queues its name, the loader swaps the new snapshot in under a short lock
+    /// Without inotify nothing is mapped and get() always returns nullptr (the caller falls back to sendfile)
+    class FileStore {
+    public:
+        FileStore(boost::asio::io_context &io_context, Logger::Ptr logger)
+                : events(io_context), logger(std::move(logger)) {
+            int fd = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+            if (fd < 0) {
+                this->logger->log(Level::Warning, "inotify is not available, files are not memory-mapped");
+                return;
+            }
+            events.assign(fd);
+            loader = std::thread([this] { loadLoop(); });
+            do_read_events();
+        }
+
+        ~FileStore() {
+            if (!loader.joinable()) {
+                return;
+            }
+            {
+                std::lock_guard lock(queueMutex);
+                stopping = true;
+            }
+            wakeUp.notify_one();
+            loader.join();
+        }
+
+        FileStore(const FileStore &) = delete;
+        FileStore &operator=(const FileStore &) = delete;
+
+        /// Maps the file & starts watching it
+        /// @param filename - the path of the file, as registered in the endpoint
+        void add(const std::string &filename) {
+            if (!events.is_open()) {
+                return;
+            }
+            std::size_t slash = filename.rfind('/');
+            std::string directory = slash == std::string::npos ? "." : (slash == 0 ? "/" : filename.substr(0, slash));
+            std::string name = slash == std::string::npos ? filename : filename.substr(slash + 1);
+            int wd = ::inotify_add_watch(events.native_handle(), directory.c_str(),
+                                         IN_CLOSE_WRITE | IN_CREATE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE);
+            if (wd < 0) {
+                logger->log(Level::Warning, "Can not watch directory " + directory + ", file " + filename + " is not memory-mapped");
+                return;
+            }
+            std::unique_lock lock(mutex);
+            watched[wd][name] = filename;
+            files[filename] = MappedFile::load(filename);
+        }
+
+        /// @return the current mapping of the file; nullptr if it is not mapped
+        MappedFile::Ptr get(std::string_view filename) const {
+            std::shared_lock lock(mutex);
+            auto it = files.find(filename);
+            return it != files.end() ? it->second : nullptr;
+        }
+
+    private:
+        void do_read_events() {
+            events.async_read_some(boost::asio::buffer(buffer), [this](const boost::system::error_code &ec, std::size_t length) {
+                if (ec) {
+                    if (ec != boost::asio::error::operation_aborted) {
+                        logger->log(Level::Error, "Internal error in FileStore: " + ec.message());
+                    }
+                    return;
+                }
+                for (std::size_t offset = 0; offset + sizeof(inotify_event) <= length;) {
+                    const auto *event = reinterpret_cast<const inotify_event *>(buffer.data() + offset);
+                    if (event->mask & IN_Q_OVERFLOW) {
+                        refreshAll();
+                    } else if (event->len > 0) {
+                        refresh(event->wd, event->name);
+                    }
+                    offset += sizeof(inotify_event) + event->len;
+                }
+                do_read_events();
+            });
+        }
+
+        /// Queues the changed file for the loader; the responses being sent keep the old mapping
+        void refresh(int wd, const char *name) {
+            std::shared_lock lock(mutex);
+            auto directory = watched.find(wd);
+            if (directory == watched.end()) {
+                return;
+            }
+            std::string_view changed(name);
+            auto file = directory->second.find(std::string(changed));
+            for (std::string_view suffix : Compression::SUFFIXES) {
+                // a sibling file changed: its file is loaded again
+                if (file == directory->second.end() && changed.size() > suffix.size()
+                    && changed.substr(changed.size() - suffix.size()) == suffix) {
+                    file = directory->second.find(std::string(changed.substr(0, changed.size() - suffix.size())));
+                }
+            }
+            if (file == directory->second.end()) {
+                return;
+            }
+            std::vector<std::string> filenames{file->second};
+            lock.unlock();
+            enqueue(std::move(filenames));
+        }
+
+        /// The inotify queue overflowed, the changes are lost: every file is loaded again
+        void refreshAll() {
+            std::vector<std::string> filenames;
+            {
+                std::shared_lock lock(mutex);
+                for (const auto &entry : files) {
+                    filenames.push_back(entry.first);
+                }
+            }
+            enqueue(std::move(filenames));
+        }
+
+        /// A file already waiting for the loader is not queued twice: an editor's burst of events costs one load
+        void enqueue(std::vector<std::string> filenames) {
+            {
+                std::lock_guard lock(queueMutex);
+                for (auto &filename : filenames) {
+                    if (std::find(pending.begin(), pending.end(), filename) == pending.end()) {
+                        pending.push_back(std::move(filename));
+                    }
+                }
+            }
+            wakeUp.notify_one();
+        }
+
+        void loadLoop() noexcept {
+            while (true) {
+                std::string filename;
+                {
+                    std::unique_lock lock(queueMutex);
+                    wakeUp.wait(lock, [this] { return stopping || !pending.empty(); });
+                    if (stopping) {
+                        return;
+                    }
+                    filename = std::move(pending.front());
+                    pending.pop_front();
+                }
+                try {
+                    MappedFile::Ptr mapping = MappedFile::load(filename);  // may be nullptr if the file is gone
+                    std::unique_lock lock(mutex);
+                    files[filename].swap(mapping);
+                    lock.unlock();  // the old snapshot is released outside the lock
+#ifdef DEBUG
+                    logger->log(Level::Debug, "File " + filename + " remapped");
+#endif
+                } catch (const std::exception &e) {
+                    logger->log(Level::Error, "Failed to load file " + filename + ": " + e.what());
+                }
+            }
+        }
+
+        mutable std::shared_mutex mutex;
+        std::map<std::string, MappedFile::Ptr, std::less<>> files;
+        std::unordered_map<int, std::unordered_map<std::string, std::string>> watched;  // wd -> name -> filename
+        boost::asio::posix::stream_descriptor events;
+        alignas(inotify_event) std::array<char, 4096> buffer;
+        Logger::Ptr logger;
+        std::mutex queueMutex;
+        std::deque<std::string> pending;  // the filenames waiting for the loader
+        bool stopping = false;
+        std::condition_variable wakeUp;
+        std::thread loader;
+    };
+
+    /// An endpoint known at compile time, see StaticRouteTable
+    struct StaticRoute {
+        std::string_view path;
+        std::string_view body;
+        Method method = Method::GET;
+        std::string_view content_type = "text/html";
+    };
+
+    /// Perfect hash table of the routes, built by the compiler: every (path, method) maps to its own slot, so a lookup
+    /// is one hash of the path, one displacement read & one comparison
+    /// Usage: static constexpr StaticRoute routes[] = {{"/health", "OK"}, {"/version", "1.0"}};
+    ///        static constexpr auto table = makeStaticRoutes(routes);
+    ///        app.AddStaticRoutes(table);
+    /// A path may be routed once per method; duplicate routes are a compile error
+    template <std::size_t N>
+    class StaticRouteTable {
+    public:
+        static constexpr std::size_t SLOTS = StaticHash::slotsFor(N);
+
+        constexpr explicit StaticRouteTable(const StaticRoute (&routes)[N]) : slots_(), displacements_() {
+            build(routes);
+        }
+
+        /// @return the route with this path & method or nullptr
+        constexpr const StaticRoute *find(std::string_view path, Method method = Method::GET) const noexcept {
+            std::uint64_t hash = StaticHash::hash(path, method);
+            const StaticRoute &route = slots_[StaticHash::slot(hash, displacements_[hash & (SLOTS - 1)], SLOTS - 1)];
+            return route.path.data() != nullptr && route.path == path && route.method == method ? &route : nullptr;
+        }
+
+        constexpr const std::array<StaticRoute, SLOTS> &slots() const noexcept {
+            return slots_;
+        }
+
+        constexpr const std::array<std::int32_t, SLOTS> &displacements() const noexcept {
+            return displacements_;
+        }
+
+    private:
+        /// Buckets by the first hash, the biggest ones are placed first by searching a displacement that sends
+        /// all of their paths to free slots; single-path buckets then take the remaining slots directly
+        constexpr void build(const StaticRoute (&routes)[N]) {
+            constexpr std::size_t mask = SLOTS - 1;
+            std::array<std::uint64_t, N> hashes{};
+            std::array<std::size_t, SLOTS + 1> starts{};  // the routes of a bucket, counting sort
+            std::array<std::size_t, N> order{};
+            for (std::size_t i = 0; i < N; ++i) {
+                hashes[i] = StaticHash::hash(routes[i].path, routes[i].method);
+                ++starts[(hashes[i] & mask) + 1];
+            }
+            std::size_t largest = 0;
+            for (std::size_t b = 0; b < SLOTS; ++b) {
+                largest = std::max(largest, starts[b + 1]);
+                starts[b + 1] += starts[b];
+            }
+            std::array<std::size_t, SLOTS> filled{};
+            for (std::size_t i = 0; i < N; ++i) {
+                std::size_t b = hashes[i] & mask;
+                for (std::size_t k = starts[b]; k < starts[b] + filled[b]; ++k) {
+                    // equal routes always share a bucket
+                    if (routes[order[k]].path == routes[i].path && routes[order[k]].method == routes[i].method) {
+                        throw std::logic_error("duplicate static route");
+                    }
+                }
+                order[starts[b] + filled[b]++] = i;
+            }
+            std::array<bool, SLOTS> used{};
+            std::array<std::size_t, N> candidate{};
+            for (std::size_t size = largest; size > 1; --size) {
+                for (std::size_t b = 0; b < SLOTS; ++b) {
+                    if (starts[b + 1] - starts[b] != size) {
+                        continue;
+                    }
+                    for (std::int32_t displacement = 1;; ++displacement) {
+                        if (displacement == (1 << 24)) {
+                            throw std::logic_error("no perfect hash found");
+                        }
+                        bool fits = true;
+                        for (std::size_t k = 0; k < size && fits; ++k) {
+                            candidate[k] = StaticHash::mix(hashes[order[starts[b] + k]], displacement) & mask;
+                            fits = !used[candidate[k]];
+                            for (std::size_t m = 0; m < k && fits; ++m) {
+                                fits = candidate[m] != candidate[k];
+                            }
+                        }
+                        if (fits) {
+                            for (std::size_t k = 0; k < size; ++k) {
+                                used[candidate[k]] = true;
+                                slots_[candidate[k]] = routes[order[starts[b] + k]];
+                            }
+                            displacements_[b] = displacement;
+                            break;
+                        }
+                    }
+                }
+            }
+            std::size_t free = 0;
+            for (std::size_t b = 0; b < SLOTS; ++b) {
+                if (starts[b + 1] - starts[b] != 1) {
+                    continue;
+                }
+                while (used[free]) {
+                    ++free;
+                }
+                used[free] = true;
+                slots_[free] = routes[order[starts[b]]];
+                displacements_[b] = -static_cast<std::int32_t>(free) - 1;
+            }
+        }
+
+        std::array<StaticRoute, SLOTS> slots_;
+        std::array<std::int32_t, SLOTS> displacements_;
+    };
+
+    template <std::size_t N>
+    constexpr StaticRouteTable<N> makeStaticRoutes(const StaticRoute (&routes)[N]) {
+        return StaticRouteTable<N>(routes);
+    }
+
+    /// The runtime copy of a StaticRouteTable kept by the server: one flat array of slots, each holding the displacement
+    /// of its bucket, a view of the route path in the static storage of the table & its serialized responses,
+    /// so a lookup reads two slots of one array & compares the path once
+    class StaticRoutes {
+    public:
+        struct Response {
+            std::string_view body;     // the identity body, in the static storage of the route
+            EncodedVariants encoded;   // the heads & the compressed variants
+            std::uint32_t metrics_id = Metrics::UNMATCHED;
+        };
+
+        template <std::size_t N>
+        void assign(const StaticRouteTable<N> &table) {
+            mask = StaticRouteTable<N>::SLOTS - 1;
+            slots.assign(table.slots().size(), Slot());
+            responses.clear();
+            responses.reserve(N);  // the slots point into it
+            for (std::size_t i = 0; i < table.slots().size(); ++i) {
+                const StaticRoute &route = table.slots()[i];
+                Slot &slot = slots[i];
+                slot.displacement = table.displacements()[i];
+                if (route.path.data() == nullptr) {
+                    continue;
+                }
+                Response &response = responses.emplace_back();
+                response.encoded.build(route.body, std::string(route.content_type));
+                response.body = route.body;
+                response.metrics_id = Metrics::instance().endpoint(route.method, route.path);
+                slot.path = route.path;
+                slot.method = route.method;
+                slot.response = &response;
+            }
+        }
+
+        /// @return the serialized responses of the route or nullptr
+        const Response *find(std::string_view path, Method method) const noexcept {
+            if (slots.empty()) {
+                return nullptr;
+            }
+            std::uint64_t hash = StaticHash::hash(path, method);
+            const Slot &slot = slots[StaticHash::slot(hash, slots[hash & mask].displacement, mask)];
+            return slot.response != nullptr && slot.method == method && slot.path == path ? slot.response : nullptr;
+        }
+
+    private:
+        struct Slot {
+            std::int32_t displacement = 0;  // of the bucket with the index of this slot
+            Method method = Method::GET;
+            std::string_view path;
+            const Response *response = nullptr;  // nullptr for a free slot
+        };
+
+        std::size_t mask = 0;
+        std::vector<Slot> slots;
+        std::vector<Response> responses;
+    };
+
+    /// The values of the :param & *wildcard segments matched by Router::find
+    struct RouteParams {
+        static constexpr std::size_t MAX_PARAMS = 16;
+
+        struct Param {
+            std::string_view name;   // points into the router
+            std::string_view value;  // points into the request buffer
+        };
+
+        /// @return the value of the parameter, empty if there is none
+        std::string_view get(std::string_view name) const noexcept {
+            for (std::size_t i = 0; i < count; ++i) {
+                if (params[i].name == name) {
+                    return params[i].value;
+                }
+            }
+            return {};
+        }
+
+        std::array<Param, MAX_PARAMS> params;
+        std::size_t count = 0;
+    };
+
+    /// What a handler sees of a request; the views point into the read buffer & are valid during the call only
+    class RequestView {
+    public:
+        RequestView(const HttpRequest &request, const RouteParams &params, std::string_view body) noexcept
+            : request_(request), params_(params), body_(body) {}
+
+        std::string_view method() const noexcept { return request_.method; }
+        std::string_view path() const noexcept { return request_.path; }
+        std::string_view query() const noexcept { return request_.query; }
+        std::string_view body() const noexcept { return body_; }
+
+        /// @param name - the header name, case-insensitive
+        std::string_view header(std::string_view name) const noexcept {
+            return request_.header(name);
+        }
+
+        /// @param name - the :param or *wildcard name of the endpoint path
+        std::string_view param(std::string_view name) const noexcept {
+            return params_.get(name);
+        }
+
+        const HttpRequest &request() const noexcept { return request_; }
+        const RouteParams &params() const noexcept { return params_; }
+
+    private:
+        const HttpRequest &request_;
+        const RouteParams &params_;
+        std::string_view body_;
+    };
+
+    /// What a handler writes its response into; the session reuses the object, so the buffers keep their capacity
+    class HttpResponse {
+    public:
+        void setStatus(unsigned code, std::string_view reason) {
+            status = code;
+            this->reason.assign(reason);
+        }
+
+        void setContentType(std::string_view content_type) {
+            this->content_type.assign(content_type);
+        }
+
+        /// @param name, value - an extra header; Content-Length, Date & Connection are set by the server
+        void addHeader(std::string_view name, std::string_view value) {
+            headers.append(name).append(": ").append(value).append("\r\n");
+        }
+
+        /// Appends to the body
+        void write(std::string_view data) {
+            body_.append(data);
+        }
+
+        /// The body itself, e.g. to format into it in place
+        std::string &body() noexcept {
+            return body_;
+        }
+
+    private:
+        friend class HttpSession;
+
+        void reset() {
+            status = 200;
+            reason.assign("OK");
+            content_type.assign("text/html");
+            headers.clear();
+            body_.clear();
+        }
+
+        enum class Framing {
+            ContentLength,
+            Chunked,
+            UntilClose  // for HTTP/1.0 clients of streamed responses
+        };
+
+        /// Serializes the status line & headers into head
+        void finish(Framing framing = Framing::ContentLength) {
+            char digits[20];
+            head.assign("HTTP/1.1 ");
+            head.append(digits, std::to_chars(digits, digits + sizeof(digits), status).ptr - digits).append(" ").append(reason);
+            if (framing == Framing::ContentLength) {
+                head.append("\r\nContent-Length: ");
+                head.append(digits, std::to_chars(digits, digits + sizeof(digits), body_.size()).ptr - digits);
+            } else if (framing == Framing::Chunked) {
+                head.append("\r\nTransfer-Encoding: chunked");
+            }
+            head.append("\r\nContent-Type: ").append(content_type).append("\r\n").append(headers).append("\r\n");
+        }
+
+        unsigned status = 200;
+        std::string reason = "OK";
+        std::string content_type = "text/html";
+        std::string headers;
+        std::string body_;
+        std::string head;
+    };
+
+    /// A dynamic endpoint; runs on the session's thread, so it must not block
+    typedef std::function<void(const RequestView &request, HttpResponse &response)> Handler;
+
+    /// The producer side of a chunked response, see ChunkedHandler; may be used from any thread
+    /// Backpressure: write the next chunk from the ready callback of the previous one, so that at most one chunk
+    /// waits for the socket; dropping the last pointer without end() aborts the response & closes the connection
+    class ResponseStream {
+    public:
+        typedef std::shared_ptr<ResponseStream> Ptr;
+        /// @param written - true once the chunk is handed to the socket, false if it is dropped with the connection
+        typedef std::function<void(bool written)> Ready;
+
+        explicit ResponseStream(boost::asio::any_io_executor executor)
+            : state(std::make_shared<State>(std::move(executor))) {}
+
+        ResponseStream(const ResponseStream &) = delete;
+        ResponseStream &operator=(const ResponseStream &) = delete;
+
+        ~ResponseStream() {
+            if (!ended) {
+                post([](State &state) { state.aborted = true; });
+            }
+        }
+
+        /// @param chunk - the next piece of the body; empty pieces are skipped
+        /// @param ready - called on the session's thread once the chunk is written or dropped
+        void write(std::string chunk, Ready ready = nullptr) {
+            post([chunk = std::move(chunk), ready = std::move(ready)](State &state) mutable {
+                if (state.failed || chunk.empty()) {
+                    if (ready) {
+                        ready(!state.failed);
+                    }
+                } else {
+                    state.pending.emplace_back(std::move(chunk), std::move(ready));
+                }
+            });
+        }
+
+        /// Completes the body; nothing may be written after it
+        void end() {
+            ended = true;
+            post([](State &state) { state.ended = true; });
+        }
+
+    private:
+        friend class HttpSession;
+
+        /// Touched on the session's executor only
+        struct State {
+            explicit State(boost::asio::any_io_executor executor) : executor(std::move(executor)) {}
+
+            boost::asio::any_io_executor executor;
+            std::deque<std::pair<std::string, Ready>> pending;  // the front one is being written
+            std::function<void()> wake;  // set by the session while it writes this stream, keeps the session alive
+            bool chunked = true;         // false for HTTP/1.0 clients: the body ends with the connection
+            bool ended = false;
+            bool aborted = false;
+            bool failed = false;
+        };
+
+        template <typename F>
+        void post(F f) {
+            boost::asio::post(state->executor, [state = state, f = std::move(f)]() mutable {
+                f(*state);
+                if (state->wake) {
+                    auto wake = state->wake;  // the session may reset it meanwhile
+                    wake();
+                }
+            });
+        }
+
+        std::shared_ptr<State> state;
+        bool ended = false;
+    };
+
+    /// A streaming response endpoint: fills the status & headers of head, then pushes the body into the stream,
+    /// now or later from any thread; what is written into the head body goes out as the first chunk
+    typedef std::function<void(const RequestView &request, HttpResponse &head, ResponseStream::Ptr stream)> ChunkedHandler;
+
+    /// Receives the body of one request piece by piece, as it arrives; created by a StreamHandler
+    class BodyReader {
+    public:
+        virtual ~BodyReader() = default;
+
+        /// @param chunk - the next decoded piece of the body, valid during the call only; its size is bounded
+        ///                by the read buffer of the session
+        virtual void onData(std::string_view chunk) = 0;
+
+        /// The body is complete; writes the response
+        virtual void onEnd(HttpResponse &response) = 0;
+    };
+
+    /// A streaming endpoint: called when the headers arrive, the request view is valid during the call only
+    typedef std::function<std::unique_ptr<BodyReader>(const RequestView &request)> StreamHandler;
+
+    /// What an endpoint answers with
+    struct Endpoint {
+        std::string response;          // the body, or @file: followed by the file name
+        Handler handler;               // if set, the response is ignored; the body is buffered for it
+        StreamHandler stream_handler;  // if set, the response is ignored; the body is streamed to its reader
+        std::size_t max_body_bytes = 0;  // 0: SessionOptions::max_body_bytes; bodies of other endpoints are discarded
+        ChunkedHandler chunked_handler;  // if set, the response is ignored; the body is buffered for it
+        EncodedVariants encoded;         // of a response body given as a string
+        std::uint32_t metrics_id = Metrics::UNMATCHED;  // set by the server, see Metrics::endpoint
+    };
+
+    /// Compressed radix tree of the endpoint patterns: a lookup walks the path once, whatever the number of routes
+    /// Patterns: "/users" (exact), "/users/:id/posts" (one segment), "/static/*path" (the rest of the path, last only)
+    /// Static segments win over parameters, parameters win over wildcards
+    class Router {
+    public:
+        /// @return false if the pattern is malformed or names a parameter differently from an earlier pattern
+        bool add(std::string_view pattern, Method method, Endpoint endpoint) {
+            Node *node = &root;
+            while (!pattern.empty()) {
+                if (pattern.front() == ':' || pattern.front() == '*') {
+                    bool wildcard = pattern.front() == '*';
+                    std::size_t end = wildcard ? pattern.size() : std::min(pattern.find('/'), pattern.size());
+                    std::string_view name = pattern.substr(1, end - 1);
+                    if (name.empty() || (wildcard && name.find('/') != std::string_view::npos)) {
+                        return false;
+                    }
+                    std::unique_ptr<Node> &child = wildcard ? node->wildcard : node->param;
+                    if (!child) {
+                        child = std::make_unique<Node>();
+                        child->prefix = name;
+                    } else if (child->prefix != name) {
+                        return false;
+                    }
+                    node = child.get();
+                    pattern.remove_prefix(end);
+                    continue;
+                }
+                // the static run lasts until a segment starting with ':' or '*'
+                std::size_t end = 0;
+                while (end < pattern.size() && !(pattern[end] == '/' && end + 1 < pattern.size()
+                                                 && (pattern[end + 1] == ':' || pattern[end + 1] == '*'))) {
+                    ++end;
+                }
+                end = std::min(end + 1, pattern.size());
+                std::string_view run = pattern.substr(0, end);
+                pattern.remove_prefix(end);
+                while (!run.empty()) {
+                    auto it = std::find_if(node->children.begin(), node->children.end(),
+                                           [&run](const std::unique_ptr<Node> &child) { return child->prefix.front() == run.front(); });
+                    if (it == node->children.end()) {
+                        node->children.push_back(std::make_unique<Node>());
+                        node->children.back()->prefix = run;
+                        node = node->children.back().get();
+                        break;
+                    }
+                    Node &child = **it;
+                    std::size_t common = 0;
+                    while (common < child.prefix.size() && common < run.size() && child.prefix[common] == run[common]) {
+                        ++common;
+                    }
+                    if (common < child.prefix.size()) {
+                        // split the edge: the child keeps the shared part, the rest moves one level down
+                        auto tail = std::make_unique<Node>();
+                        tail->prefix = child.prefix.substr(common);
+                        tail->children = std::move(child.children);
+                        tail->param = std::move(child.param);
+                        tail->wildcard = std::move(child.wildcard);
+                        tail->endpoints = std::move(child.endpoints);
+                        child.prefix.resize(common);
+                        child.children.clear();
+                        child.children.push_back(std::move(tail));
+                    }
+                    node = &child;
+                    run.remove_prefix(common);
+                }
+            }
+            node->endpoints[static_cast<std::size_t>(method)] = std::make_unique<Endpoint>(std::move(endpoint));
+            return true;
+        }
+
+        /// @param path - the request path, without the query
+        /// @param params - filled with the matched parameters
+        /// @return the endpoint or nullptr
+        const Endpoint *find(std::string_view path, Method method, RouteParams &params) const noexcept {
+            params.count = 0;
+            return match(root, path, static_cast<std::size_t>(method), params);
+        }
+
+    private:
+        struct Node {
+            std::string prefix;  // the static part of the edge, or the parameter name
+            std::vector<std::unique_ptr<Node>> children;  // static edges, their prefixes start with distinct chars
+            std::unique_ptr<Node> param;
+            std::unique_ptr<Node> wildcard;
+            std::array<std::unique_ptr<Endpoint>, METHODS_COUNT> endpoints;
+        };
+
+        /// @param path - what is left of the path after the node
+        static const Endpoint *match(const Node &node, std::string_view path, std::size_t method,
+                                     RouteParams &params) noexcept {
+            if (path.empty() && node.endpoints[method]) {
+                return node.endpoints[method].get();
+            }
+            if (!path.empty()) {
+                for (const auto &child : node.children) {
+                    if (child->prefix.front() == path.front()) {
+                        if (path.compare(0, child->prefix.size(), child->prefix) == 0) {
+                            if (const Endpoint *endpoint = match(*child, path.substr(child->prefix.size()), method, params)) {
+                                return endpoint;
+                            }
+                        }
+                        break;
+                    }
+                }
+            }
+            if (node.param && !path.empty() && path.front() != '/' && params.count < RouteParams::MAX_PARAMS) {
+                std::size_t end = std::min(path.find('/'), path.size());
+                params.params[params.count++] = {node.param->prefix, path.substr(0, end)};
+                if (const Endpoint *endpoint = match(*node.param, path.substr(end), method, params)) {
+                    return endpoint;
+                }
+                --params.count;
+            }
+            if (node.wildcard && node.wildcard->endpoints[method] && params.count < RouteParams::MAX_PARAMS) {
+                params.params[params.count++] = {node.wildcard->prefix, path};
+                return node.wildcard->endpoints[method].get();
+            }
+            return nullptr;
+        }
+
+        Node root;
+    };
+
+    /// Recycled storage for the states of the asynchronous operations of one owner (asio's custom allocation
+    /// pattern, see AllocHandler): a session has only a few operations in flight at once, so their memory comes
+    /// from its slots instead of the heap; extra or bigger operations fall back to the heap
+    /// The slots are taken & freed atomically: with a strand, an operation completes (& frees its state) on any
+    /// thread while the owner starts the next one
+    class HandlerMemory {
+    public:
+        static constexpr std::size_t SLOTS = 3;        // a read or a write, the idle timer & a cancelled timer wait
+        static constexpr std::size_t SLOT_SIZE = 768;   // the biggest state, of a gather write, takes about 500 bytes
+
+        HandlerMemory() = default;
+        HandlerMemory(const HandlerMemory &) = delete;
+        HandlerMemory &operator=(const HandlerMemory &) = delete;
+
+        void *allocate(std::size_t size) {
+            if (size <= SLOT_SIZE) {
+                for (Slot &slot : slots) {
+                    if (!slot.used.load(std::memory_order_relaxed) && !slot.used.exchange(true, std::memory_order_acquire)) {
+                        return slot.storage;
+                    }
+                }
+            }
+            return ::operator new(size);
+        }
+
+        void deallocate(void *pointer) noexcept {
+            for (Slot &slot : slots) {
+                if (pointer == slot.storage) {
+                    slot.used.store(false, std::memory_order_release);
+                    return;
+                }
+            }
+            ::operator delete(pointer);
+        }
+
+    private:
+        struct Slot {
+            alignas(std::max_align_t) unsigned char storage[SLOT_SIZE];
+            std::atomic<bool> used{false};
+        };
+
+        std::array<Slot, SLOTS> slots;
+    };
+
+    /// The allocator asio finds through associated_allocator of an AllocHandler
+    template <class T>
+    class HandlerAllocator {
+    public:
+        typedef T value_type;
+
+        explicit HandlerAllocator(HandlerMemory &memory) noexcept : memory(&memory) {}
+
+        template <class U>
+        HandlerAllocator(const HandlerAllocator<U> &other) noexcept : memory(other.memory) {}
+
+        T *allocate(std::size_t n) {
+            return static_cast<T *>(memory->allocate(sizeof(T) * n));
+        }
+
+        void deallocate(T *pointer, std::size_t) noexcept {
+            memory->deallocate(pointer);
+        }
+
+        template <class U>
+        bool operator==(const HandlerAllocator<U> &other) const noexcept {
+            return memory == other.memory;
+        }
+
+        template <class U>
+        bool operator!=(const HandlerAllocator<U> &other) const noexcept {
+            return memory != other.memory;
+        }
+
+    private:
+        template <class U>
+        friend class HandlerAllocator;
+
+        HandlerMemory *memory;
+    };
+
+    /// A completion handler whose operation state is allocated from a HandlerMemory; the memory must outlive
+    /// the operation, e.g. be a member of the session the handler keeps alive
+    template <class Handler>
+    class AllocHandler {
+    public:
+        typedef HandlerAllocator<Handler> allocator_type;
+
+        AllocHandler(HandlerMemory &memory, Handler handler) : memory(memory), handler(std::move(handler)) {}
+
+        allocator_type get_allocator() const noexcept {
+            return allocator_type(memory);
+        }
+
+        template <class... Args>
+        void operator()(Args &&...args) {
+            handler(std::forward<Args>(args)...);
+        }
+
+    private:
+        HandlerMemory &memory;
+        Handler handler;
+    };
+
+    template <class Handler>
+    AllocHandler<std::decay_t<Handler>> makeAllocHandler(HandlerMemory &memory, Handler &&handler) {
+        return AllocHandler<std::decay_t<Handler>>(memory, std::forward<Handler>(handler));
+    }
+
+    /// Per-thread free list of fixed-size blocks: the memory of closed sessions is reused by the next connections
+    /// accepted on the thread; a block freed on another thread joins that thread's list
+    template <class T>
+    class PoolAllocator {
+    public:
+        typedef T value_type;
+
+        /// @param high_water - the number of free blocks a thread keeps, the rest go back to the heap
+        explicit PoolAllocator(std::size_t high_water) noexcept : high_water(high_water) {}
+
+        template <class U>
+        PoolAllocator(const PoolAllocator<U> &other) noexcept : high_water(other.high_water) {}
+
+        T *allocate(std::size_t n) {
+            FreeList &list = freeList();
+            if (n == 1 && list.head) {
+                Block *block = list.head;
+                list.head = block->next;
+                --list.count;
+                return reinterpret_cast<T *>(block);
+            }
+            return static_cast<T *>(::operator new(n * sizeof(T)));
+        }
+
+        void deallocate(T *pointer, std::size_t n) noexcept {
+            FreeList &list = freeList();
+            if (n == 1 && list.count < high_water) {
+                Block *block = reinterpret_cast<Block *>(pointer);
+                block->next = list.head;
+                list.head = block;
+                ++list.count;
+                return;
+            }
+            ::operator delete(pointer);
+        }
+
+        template <class U>
+        bool operator==(const PoolAllocator<U> &) const noexcept {
+            return true;  // any allocator of a type frees the blocks of any other
+        }
+
+        template <class U>
+        bool operator!=(const PoolAllocator<U> &) const noexcept {
+            return false;
+        }
+
+    private:
+        template <class U>
+        friend class PoolAllocator;
+
+        static_assert(sizeof(T) >= sizeof(void *), "a free block stores the link to the next one");
+
+        struct Block {
+            Block *next;
+        };
+
+        struct FreeList {
+            ~FreeList() {
+                while (head) {
+                    Block *next = head->next;
+                    ::operator delete(head);
+                    head = next;
+                }
+            }
+
+            Block *head = nullptr;
+            std::size_t count = 0;
+        };
+
+        static FreeList &freeList() noexcept {
+            static thread_local FreeList list;
+            return list;
+        }
+
+        std::size_t high_water;
+    };
+
+    /// Per-thread free list of session read buffers, see PoolAllocator
+    class BufferPool {
+    public:
+        /// @return a buffer of the size, recycled if possible
+        static std::vector<char> acquire(std::size_t size) {
+            std::vector<std::vector<char>> &buffers = freeList();
+            if (buffers.empty()) {
+                return std::vector<char>(size);
+            }
+            std::vector<char> buffer = std::move(buffers.back());
+            buffers.pop_back();
+            buffer.resize(size);
+            return buffer;
+        }
+
+        /// @param size - the usual size of the buffers; grown ones (for request bodies) are freed
+        /// @param high_water - the number of buffers a thread keeps
+        static void release(std::vector<char> &&buffer, std::size_t size, std::size_t high_water) noexcept {
+            std::vector<std::vector<char>> &buffers = freeList();
+            if (buffer.capacity() != size || buffers.size() >= high_water) {
+                return;
+            }
+            try {
+                buffers.push_back(std::move(buffer));
+            } catch (...) {
+                // not kept then
+            }
+        }
+
+    private:
+        static std::vector<std::vector<char>> &freeList() noexcept {
+            static thread_local std::vector<std::vector<char>> buffers;
+            return buffers;
+        }
+    };
+
+    /// The number of the sessions of a server against SessionOptions::max_sessions, with a low-water mark:
+    /// once the limit is reached the server is overloaded until the sessions drain to the mark
+    /// Shared with the sessions, which may be closed on any thread & outlive the server
+    class Admission : public std::enable_shared_from_this<Admission> {
+    public:
+        typedef std::shared_ptr<Admission> Ptr;
+
+        explicit Admission(boost::asio::io_context &io_context) : io_context(io_context) {}
+
+        /// Called by the server for every accepted connection
+        /// @return true if the connection is over the limit
+        bool overloaded(const SessionOptions &options) noexcept {
+            if (options.max_sessions == 0) {
+                over.store(false, std::memory_order_relaxed);
+                return false;
+            }
+            low_water.store(options.sessions_low_water ? std::min(options.sessions_low_water, options.max_sessions - 1)
+                                                       : options.max_sessions * 9 / 10, std::memory_order_relaxed);
+            if (sessions.load(std::memory_order_relaxed) >= options.max_sessions) {
+                over.store(true, std::memory_order_relaxed);
+            }
+            return over.load(std::memory_order_relaxed);
+        }
+
+        /// Stops accepting until the sessions drain to the low-water mark, then the resume callback is posted
+        /// @return false if the sessions have drained meanwhile: accept at once
+        bool pause() noexcept {
+            paused.store(true, std::memory_order_seq_cst);
+            // a session closed before the flag was seen resumes nothing: check again
+            if (sessions.load(std::memory_order_seq_cst) <= low_water.load(std::memory_order_relaxed)
+                && paused.exchange(false)) {
+                over.store(false, std::memory_order_relaxed);
+                return false;
+            }
+            return true;
+        }
+
+        void open() noexcept {
+            sessions.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        void close() {
+            if (sessions.fetch_sub(1, std::memory_order_seq_cst) - 1 > low_water.load(std::memory_order_relaxed)) {
+                return;
+            }
+            over.store(false, std::memory_order_relaxed);
+            if (paused.exchange(false)) {
+                boost::asio::post(io_context, [self = shared_from_this()] {
+                    std::lock_guard lock(self->mutex);
+                    if (self->resume) {
+                        self->resume();
+                    }
+                });
+            }
+        }
+
+        /// @param callback - re-arms the accept, called on the io_context; nullptr when the server is destroyed
+        void onResume(std::function<void()> callback) {
+            std::lock_guard lock(mutex);
+            resume = std::move(callback);
+            if (!resume) {
+                paused.store(false);
+            }
+        }
+
+        std::size_t count() const noexcept {
+            return sessions.load(std::memory_order_relaxed);
+        }
+
+    private:
+        boost::asio::io_context &io_context;
+        std::atomic<std::size_t> sessions{0};
+        std::atomic<std::size_t> low_water{0};
+        std::atomic<bool> over{false};    // the limit was reached & the sessions have not drained yet
+        std::atomic<bool> paused{false};  // the accept is not armed, the next close to the mark resumes it
+        std::mutex mutex;                 // the callback against the destruction of the server
+        std::function<void()> resume;
+    };
+
+    class HttpSession : public std::enable_shared_from_this<HttpSession>, Interfaces::HttpSessionInterface {
+    public:
+        /// @param socket - the accepted socket; its executor must be a strand, so that all the callbacks
+        ///                 of the session are serialized even if the io_context is run by several threads
+        HttpSession(boost::asio::ip::tcp::socket socket,
+                    const Router &router,
+                    Logger::Ptr logger,
+                    Cache &cache,
+                    const SessionOptions &options,
+                    const Clock &clock,
+                    const FileStore &files,
+                    const StaticRoutes &static_routes,
+                    Admission::Ptr admission,
+                    bool enable_cache = true)
+            try : socket_(std::move(socket)), timer_(socket_.get_executor()), buffer_(BufferPool::acquire(options.max_header_bytes)),
+                  parser_(options.max_header_bytes), router(router), options(options), clock(clock),
+                  files(files), static_routes(static_routes), enable_cache(enable_cache), logger(logger), cache(cache),
+                  admission(std::move(admission)), buffer_size(options.max_header_bytes), pool_size(options.pool_size) {
+            this->admission->open();
+            Metrics::local().sessions_opened.add();
+#ifdef DEBUG
+            logger->log(Level::Debug, "HttpSession object created");
+#endif
+        } catch (...) {
+            logger->log(Level::Error, "Failed to create HttpSession object");
+        }
+
+        void start() override {
+            do_read();
+        }
+
+        ~HttpSession() {
+            for (QueuedResponse &queued : responses_) {
+                if (queued.stream) {
+                    close_stream(*queued.stream, true);
+                }
+            }
+            BufferPool::release(std::move(buffer_), buffer_size, pool_size);
+            Metrics::local().sessions_closed.add();
+            admission->close();
+#ifdef DEBUG
+            logger->log(Level::Debug, "HttpSession object destroyed");
+#endif
+        }
+
+    private:
+        static constexpr std::size_t MAX_CACHED_FILE = 256 * 1024;  // unmapped files up to it are kept in the cache
+
+        /// Closes the connection if the next request does not arrive within the idle timeout
+        void wait_idle() {
+            auto self = shared_from_this();
+            timer_.expires_after(options.idle_timeout);
+            timer_.async_wait(makeAllocHandler(handler_memory_, [this, self](const boost::system::error_code &ec) {
+                // the timer may have been re-armed after this handler was queued, so check the deadline itself
+                if (!ec && timer_.expiry() <= std::chrono::steady_clock::now()) {
+                    boost::system::error_code ignored_ec;
+                    socket_.close(ignored_ec);
+#ifdef DEBUG
+                    logger->log(Level::Debug, "Idle connection closed");
+#endif
+                }
+            }));
+        }
+
+        /// @return true if the connection should be kept alive after the response to the request
+        static bool keep_alive_requested(const HttpRequest &request) noexcept {
+            bool keep_alive = request.version == "HTTP/1.1";
+            std::string_view connection = request.header("Connection");
+            if (hasToken(connection, "close")) {
+                keep_alive = false;
+            } else if (hasToken(connection, "keep-alive")) {
+                keep_alive = true;
+            }
+            return keep_alive;
+        }
+
+        /// @param length - the Content-Length of the request, 0 if there is none
+        /// @return false if the header is malformed
+        static bool body_length(const HttpRequest &request, std::size_t &length) noexcept {
+            std::string_view value = request.header("Content-Length");
+            length = 0;
+            if (value.empty()) {
+                return request.count("Content-Length") == 0;  // an empty value is malformed
+            }
+            auto [end, ec] = std::from_chars(value.data(), value.data() + value.size(), length);
+            return ec == std::errc() && end == value.data() + value.size();
+        }
+
+        /// Answers one parsed request & records its parse & handler times for the endpoint it is routed to
+        /// @param body - the request body, already in the read buffer
+        void handle_request(const HttpRequest &request, std::string_view body) {
+            auto start = std::chrono::steady_clock::now();
+            endpoint_ = Metrics::UNMATCHED;
+            route_request(request, body);
+            responses_.back().endpoint = endpoint_;
+            Metrics::EndpointSlot &metrics = Metrics::local().endpoint(endpoint_);
+            metrics.parse.record(parse_ns_);
+            metrics.handler.record(elapsed_ns(start));
+            parse_ns_ = 0;
+        }
+
+        static std::uint64_t elapsed_ns(std::chrono::steady_clock::time_point start) noexcept {
+            return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - start).count());
+        }
+
+        /// Routes one parsed request and appends its response to responses_; what it queues must not point into arena_
+        /// Sets endpoint_ to the id of the matched endpoint
+        void route_request(const HttpRequest &request, std::string_view body) {
+            arena_.release();  // nothing of the previous request lives in it any more
+            Method request_method = request.method == "GET" ? Method::GET : Method::POST;
+            std::string_view accept_encoding = request.header("Accept-Encoding");
+            if (const StaticRoutes::Response *response = static_routes.find(request.path, request_method)) {
+                endpoint_ = response->metrics_id;
+                // the server outlives the writes of its sessions, so the response is shared without a reference count
+                int coding = response->encoded.choose(accept_encoding);
+                if (request_method == Method::GET && response->encoded.fresh(request, coding)) {
+                    responses_.push_back({&response->encoded.notModified(coding)});
+                } else {
+                    std::string_view body = coding == Compression::IDENTITY ? response->body : response->encoded.body(coding);
+                    responses_.push_back({&response->encoded.head(coding), FileBody(), nullptr, body});
+                }
+                log_request(Level::Info, {"Endpoint ", request.path, " of type ", request.method, " responsing..."});
+                return;
+            }
+
+            if (const Endpoint *endpoint = router.find(request.path, request_method, params_)) {
+                endpoint_ = endpoint->metrics_id;
+#ifdef DEBUG
+                log_request(Level::Debug, {"Endpoint ", request.path, " of type ", request.method, " found"});
+#endif
+                if (endpoint->handler) {
+                    HttpResponse &response = next_handler_response();
+                    try {
+                        endpoint->handler(RequestView(request, params_, body), response);
+                    } catch (...) {
+                        handler_failed(response);
+                    }
+                    queue_handler_response(response);
+                    log_request(Level::Info, {"Endpoint ", request.path, " of type ", request.method, " responsing..."});
+                    return;
+                }
+                if (endpoint->chunked_handler) {
+                    HttpResponse &head = next_handler_response();
+                    auto stream = std::make_shared<ResponseStream>(socket_.get_executor());
+                    try {
+                        endpoint->chunked_handler(RequestView(request, params_, body), head, stream);
+                    } catch (...) {
+                        handler_failed(head);
+                        queue_handler_response(head);
+                        return;
+                    }
+                    queue_stream(head, *stream, request.version != "HTTP/1.0");
+                    log_request(Level::Info, {"Endpoint ", request.path, " of type ", request.method, " streaming..."});
+                    return;
+                }
+                if (endpoint->stream_handler) {
+                    // a request without a body: the reader gets none
+                    start_reader(*endpoint, request);
+                    finish_reader();
+                    log_request(Level::Info, {"Endpoint ", request.path, " of type ", request.method, " responsing..."});
+                    return;
+                }
+                const std::string &target = endpoint->response;
+                if (target.compare(0, filePrefix.size(), filePrefix) == 0) {
+                    // the mapped files are kept by the FileStore, with their heads & variants, so they skip the cache
+                    std::string_view mapped = std::string_view(target).substr(filePrefix.size());
+                    if (options.map_files) {
+                        if (MappedFile::Ptr file = files.get(mapped)) {
+                            // the queued response keeps the file with its heads & variants until it is sent
+                            int coding = file->encoded.choose(accept_encoding);
+                            if (request_method == Method::GET && file->encoded.fresh(request, coding)) {
+                                responses_.push_back({&file->encoded.notModified(coding), FileBody(), file});
+                            } else {
+                                std::string_view body = coding == Compression::IDENTITY ? file->body() : file->encoded.body(coding);
+                                responses_.push_back({&file->encoded.head(coding), FileBody(), file, body});
+                            }
+                            log_request(Level::Info, {"Endpoint ", request.path, " of type ", request.method, " responsing..."});
+                            return;
+                        }
+                    }
+                    // without the mappings the small files are read once & kept in the cache with their heads,
+                    // a hit costs a stat telling that the file has not changed; the larger ones are sent
+                    // with sendfile per request. The validators come from the same stat: a fresh file is
+                    // answered with 304 before it is read or even opened
+                    std::string filename(mapped);
+                    struct stat info{};
+                    if (::stat(filename.c_str(), &info) == 0 && S_ISREG(info.st_mode)) {
+                        FileTag tag(static_cast<std::size_t>(info.st_size), info.st_mtim);
+                        Cache::Value cached = enable_cache ? cache.get(request.method, request.path) : nullptr;
+                        if (cached && !cached->matches(info)) {
+                            cached = nullptr;
+                        }
+                        if (enable_cache) {
+                            (cached ? Metrics::local().cache_hits : Metrics::local().cache_misses).add();
+                        }
+                        // a cached file is negotiated like a mapped one, the tags of its variants included
+                        int coding = cached ? cached->encoded.choose(accept_encoding) : Compression::IDENTITY;
+                        bool fresh = request_method == Method::GET
+                                     && (cached ? cached->encoded.fresh(request, coding)
+                                                : EncodedVariants::fresh(request, tag.etag(), info.st_mtime));
+                        if (fresh) {
+                            if (cached) {
+                                const std::string *not_modified = &cached->encoded.notModified(coding);
+                                responses_.push_back({not_modified, FileBody(), std::move(cached)});
+                            } else {
+                                auto not_modified = std::make_shared<const std::string>(Templates::Responses::NOT_MODIFIED(
+                                        EncodedVariants::validatorHeaders(tag.etag(), info.st_mtime)));
+                                responses_.push_back({not_modified.get(), FileBody(), std::move(not_modified)});
+                            }
+                            log_request(Level::Info, {"Endpoint ", request.path, " of type ", request.method, " not modified"});
+                            return;
+                        }
+                        if (cached) {
+                            const Cache::Response &response = *cached;
+                            std::string_view body = coding == Compression::IDENTITY ? std::string_view(response.body)
+                                                                                    : response.encoded.body(coding);
+                            responses_.push_back({&response.encoded.head(coding), FileBody(), std::move(cached), body});
+                            log_request(Level::Info, {"Endpoint ", request.path, " of type ", request.method, " responsing..."});
+                            return;
+                        }
+                    }
+                    FileBody file(filename);
+                    if (!file) {
+                        // a missing target is the client's 404, any other failure is the server's own
+                        bool missing = file.error() == ENOENT || file.error() == ENOTDIR;
+                        responses_.push_back({missing ? &errors().not_found : &errors().internal_error});
+                        logger->log(Level::Error, "Can not open file " + filename + ": " + std::strerror(file.error()));
+                        return;
+                    }
+                    // the validators of the opened file, it may have changed since the stat
+                    FileTag tag(file.length(), file.modified());
+                    if (enable_cache && file.length() <= MAX_CACHED_FILE) {
+                        auto response = std::make_shared<Cache::Response>();
+                        if (file.read(response->body)) {
+                            // compressed here, once per change of the file; the hits only pick a variant
+                            response->encoded.build(response->body, "text/html", {}, file.modified().tv_sec,
+                                                    std::string(tag.version()));
+                            response->size = file.length();
+                            response->modified = file.modified();
+                            cache.put(request.method, request.path, response);
+#ifdef DEBUG
+                            log_request(Level::Debug, {"Endpoint ", request.path, " of type ", request.method, " added to the cache"});
+#endif
+                            const Cache::Response &queued = *response;
+                            int coding = queued.encoded.choose(accept_encoding);
+                            std::string_view body = coding == Compression::IDENTITY ? std::string_view(queued.body)
+                                                                                    : queued.encoded.body(coding);
+                            responses_.push_back({&queued.encoded.head(coding), FileBody(), std::move(response), body});
+                            log_request(Level::Info, {"Endpoint ", request.path, " of type ", request.method, " responsing..."});
+                            return;
+                        }
+                    }
+                    auto head = std::make_shared<const std::string>(Templates::Responses::OK_HEAD(
+                            file.length(), "text/html", EncodedVariants::validatorHeaders(tag.etag(), file.modified().tv_sec)));
+                    responses_.push_back({head.get(), std::move(file), std::move(head)});
+                    log_request(Level::Info, {"Endpoint ", request.path, " of type ", request.method, " responsing..."});
+                    return;
+                }
+                // the validators are checked first: a fresh representation needs no body at all
+                int coding = endpoint->encoded.choose(accept_encoding);
+                if (request_method == Method::GET && endpoint->encoded.fresh(request, coding)) {
+                    responses_.push_back({&endpoint->encoded.notModified(coding)});
+                    log_request(Level::Info, {"Endpoint ", request.path, " of type ", request.method, " not modified"});
+                    return;
+                }
+                if (coding != Compression::IDENTITY) {
+                    responses_.push_back({&endpoint->encoded.head(coding), FileBody(), nullptr,
+                                          endpoint->encoded.body(coding)});
+                    log_request(Level::Info, {"Endpoint ", request.path, " of type ", request.method, " responsing..."});
+                    return;
+                }
+                // the endpoint is the response: the prebuilt head & the endpoint string go out with one gather write
+                responses_.push_back({&endpoint->encoded.head(Compression::IDENTITY), FileBody(),
+                                      nullptr, target});
+                log_request(Level::Info, {"Endpoint ", request.path, " of type ", request.method, " responsing..."});
+            } else {
+                responses_.push_back({&errors().not_found});
+                log_request(Level::Error, {"No endpoint with name ", request.path, " and method ", request.method});
+            }
+        }
+
+        /// Logs a message about the current request, built in the arena instead of the heap
+        /// @param parts - concatenated in order
+        void log_request(Level level, std::initializer_list<std::string_view> parts) {
+            std::pmr::string message(&arena_);
+            for (std::string_view part : parts) {
+                message.append(part);
+            }
+            logger->log(level, message);
+        }
+
+        HttpResponse &next_handler_response() {
+            if (handler_responses_used_ == handler_responses_.size()) {
+                handler_responses_.push_back(std::make_unique<HttpResponse>());
+            }
+            HttpResponse &response = *handler_responses_[handler_responses_used_++];
+            response.reset();
+            return response;
+        }
+
+        void queue_handler_response(HttpResponse &response) {
+            response.finish();
+            // the response object stays in handler_responses_ until the write completes
+            responses_.push_back({&response.head, FileBody(), nullptr, response.body_});
+        }
+
+        /// @param chunked - false for the clients that can not decode chunks: the connection is closed after the body
+        void queue_stream(HttpResponse &head, ResponseStream &stream, bool chunked) {
+            stream.state->chunked = chunked;
+            if (!chunked) {
+                keep_alive = false;
+            }
+            if (!head.body_.empty()) {
+                stream.state->pending.emplace_front(head.body_, nullptr);
+            }
+            head.finish(chunked ? HttpResponse::Framing::Chunked : HttpResponse::Framing::UntilClose);
+            responses_.push_back({&head.head});
+            responses_.back().stream = stream.state;
+        }
+
+        /// Writes the chunks of the streamed response as the producer pushes them, one write at a time
+        void pump_stream() {
+            std::shared_ptr<ResponseStream::State> stream = responses_[write_index_ - 1].stream;
+            if (!stream->wake) {
+                stream->wake = [self = shared_from_this()] { self->pump_stream(); };
+            }
+            if (chunk_in_flight_) {
+                return;
+            }
+            if (stream->aborted) {
+                logger->log(Level::Warning, "Streamed response aborted by its producer");
+                close_stream(*stream, true);
+                return;
+            }
+            if (stream->pending.empty() && !stream->ended) {
+                return;  // the producer is woken by the ready callback or is still busy
+            }
+            bool last = stream->pending.empty();
+            buffers_.clear();
+            if (!last) {
+                const std::string &chunk = stream->pending.front().first;
+                if (stream->chunked) {
+                    char *end = std::to_chars(chunk_size_.data(), chunk_size_.data() + chunk_size_.size() - 2, chunk.size(), 16).ptr;
+                    *end++ = '\r';
+                    *end++ = '\n';
+                    buffers_.push_back(boost::asio::buffer(chunk_size_.data(), end - chunk_size_.data()));
+                }
+                buffers_.push_back(boost::asio::buffer(chunk));
+                if (stream->chunked) {
+                    buffers_.push_back(boost::asio::buffer("\r\n", 2));
+                }
+            } else if (stream->chunked) {
+                buffers_.push_back(boost::asio::buffer("0\r\n\r\n", 5));
+            }
+            chunk_in_flight_ = true;
+            boost::asio::async_write(socket_, BufferView(buffers_), makeAllocHandler(handler_memory_,
+                                     [this, self = shared_from_this(), stream, last](const boost::system::error_code &ec, std::size_t length) {
+                                         chunk_in_flight_ = false;
+                                         Metrics::local().bytes_sent.add(length);
+                                         if (ec) {
+                                             logger->log(Level::Error, "Internal error in pump_stream() function: " + ec.message());
+                                             close_stream(*stream, true);
+                                         } else if (last) {
+                                             close_stream(*stream, false);
+                                             if (write_index_ < responses_.size()) {
+                                                 do_write();
+                                             } else {
+                                                 finish_write();
+                                             }
+                                         } else {
+                                             ResponseStream::Ready ready = std::move(stream->pending.front().second);
+                                             stream->pending.pop_front();
+                                             if (ready) {
+                                                 ready(true);
+                                             }
+                                             pump_stream();
+                                         }
+                                     }));
+        }
 
-    class Logger : Interfaces::LoggerInterface {
-    public:
-        Logger(const std::string &program_name = "HTTPServer", const std::string &log_file_name = "log.txt",
-               bool syslog_enabled = true) try : syslogEnabled(syslog_enabled) {
-            try {
-                if (syslog_enabled) {
-                    openlog(program_name.c_str(), LOG_CONS | LOG_NDELAY | LOG_PID, LOG_USER);
+        /// Releases the session from the stream; a failed stream drops its chunks & the connection
+        void close_stream(ResponseStream::State &stream, bool failed) {
+            stream.wake = nullptr;
+            if (!failed) {
+                return;
+            }
+            stream.failed = true;
+            auto dropped = std::move(stream.pending);
+            stream.pending.clear();
+            for (auto &chunk : dropped) {
+                if (chunk.second) {
+                    chunk.second(false);
                 }
-                logFile.open(log_file_name, std::ios::out | std::ios::app);
-#ifdef DEBUG
-                std::cout << getPrefix(Level::Debug) << " Logger object created";
-#endif
-            } catch (...) {
-                std::cerr << getPrefix(Level::Critical) + " Failed to open log file and/or system log\n";
             }
-        } catch (...) {
-            std::cerr << "Failed to create Logger object\n";
+            boost::system::error_code ignored_ec;
+            socket_.close(ignored_ec);
         }
 
-        ~Logger() {
+        void handler_failed(HttpResponse &response) {
+            logger->log(Level::Error, "Handler failed: " + boost::current_exception_diagnostic_information());
+            response.reset();
+            response.setStatus(500, "Internal Server Error");
+            response.write("500 Internal Server Error!");
+        }
+
+        void start_reader(const Endpoint &endpoint, const HttpRequest &request) {
             try {
-                closelog();
-                logFile.close();
-#ifdef DEBUG
-                std::cout << getPrefix(Level::Debug) << " HttpSession object destroyed\n";
-#endif
+                reader_ = endpoint.stream_handler(RequestView(request, params_, {}));
             } catch (...) {
-                std::cerr << getPrefix(Level::Critical) + " Failed to close log file and/or system log\n";
+                logger->log(Level::Error, "Stream handler failed: " + boost::current_exception_diagnostic_information());
+                reader_.reset();
             }
         }
 
-        /// public API
-        /// @param level - the type of the logging, see enum Level
-        /// @param message - the log message, std::string
-        void log(Level level, const std::string &message) noexcept override {
-            if (syslogEnabled) {
-                try {
-                    writeToSyslog(level, message);
-                } catch (...) {
-                    std::cerr << getPrefix(Level::Error) + " Failed to log to system log\n";
-                }
-            }
+        /// Queues the response of the stream reader, a failed or missing reader gets 500
+        void finish_reader() {
+            HttpResponse &response = next_handler_response();
             try {
-                writeToFile(level, message);
+                if (!reader_) {
+                    throw std::runtime_error("no body reader");
+                }
+                reader_->onEnd(response);
             } catch (...) {
-                std::cerr << getPrefix(Level::Error) + " Failed to log to file\n";
+                handler_failed(response);
             }
+            reader_.reset();
+            queue_handler_response(response);
+            responses_.back().endpoint = endpoint_;
         }
 
-        typedef std::shared_ptr<Logger> Ptr;
+        /// The error responses, formatted once per process
+        struct ErrorResponses {
+            const std::string not_found = Templates::Responses::NOT_OK();
+            const std::string bad_request = Templates::Responses::BAD_REQUEST();
+            const std::string headers_too_large = Templates::Responses::TOO_LARGE();
+            const std::string payload_too_large = Templates::Responses::PAYLOAD_TOO_LARGE();
+            const std::string internal_error = Templates::Responses::INTERNAL_ERROR();
+        };
 
-    private:
-        void writeToSyslog(Level level, const std::string &message) {  // @TODO later: asynchronous write
-            int priority = getPriority(level);
-            char buffer[80] = {0};
-            std::time_t result = std::time(nullptr);
-            std::strftime(buffer, 80, "%Y-%m-%d %H:%M:%S", std::localtime(&result));
-            std::lock_guard lock(mu);
-            syslog(priority, "%s", (std::string(buffer) + message).c_str());  // @TODO: check workability
+        static const ErrorResponses &errors() {
+            static const ErrorResponses responses;
+            return responses;
         }
 
-        void writeToFile(Level level, const std::string &message) {  // @TODO later: asynchronous write
-            std::string prefix = std::move(getPrefix(level));
-            char buffer[80] = {0};
-            std::time_t result = std::time(nullptr);
-            std::strftime(buffer, 80, "%Y-%m-%d %H:%M:%S", std::localtime(&result));
-            std::lock_guard lock(mu);
-            logFile << buffer << " " << prefix << " " << message << std::endl;
+        /// Answers the request with an error & closes the connection after it
+        /// @param response - one of errors()
+        void reject(const std::string &response, std::string_view message) {
+            keep_alive = false;
+            body_mode_ = BodyMode::None;
+            reader_.reset();
+            responses_.push_back({&response});
+            responses_.back().close = true;
+            logger->log(Level::Warning, message);
         }
 
-        std::ofstream logFile;
-        const bool syslogEnabled;
-    };
-
-    namespace Templates::Responses {
-        const auto OK = [](const std::string &body = "Hello, World!", const std::string &content_type = "text/html") {
-            return "HTTP/1.1 200 OK\r\nContent-Length: " + std::to_string(body.length()) + "\r\nContent-Type: " + content_type + "\r\n\r\n" + body;
-        };
-        const auto NOT_OK = [](const std::string &body = "404 Not Found!") {
-            return "HTTP/1.1 404 Not Found\r\nContent-Length: 14\r\n\r\n" + body;
-        };
-    }// namespace Templates::Responses
-
-    namespace {
-        typedef std::unordered_map<std::string, std::pair<std::string, Method>> endpoints;
-
-        std::string readFileIntoString(const std::string &filename, Logger::Ptr logger) {
-            std::ifstream file(filename);
-            if (!file.is_open()) {
-                logger->log(Level::Error, "Can not open file " + filename);
-                return "";
+        /// Chooses how the body of the just parsed request is read, if there is one
+        /// @return false if the request is rejected
+        bool start_body(const HttpRequest &request) {
+            // repeated or conflicting framing headers may be read differently by a proxy in front of the server,
+            // so whatever follows them is not trusted (request smuggling)
+            std::size_t content_lengths = request.count("Content-Length");
+            std::size_t transfer_encodings = request.count("Transfer-Encoding");
+            if (content_lengths > 1 || transfer_encodings > 1 || (content_lengths && transfer_encodings)) {
+                reject(errors().bad_request, "Conflicting request body framing");
+                return false;
+            }
+            std::string_view transfer_encoding = request.header("Transfer-Encoding");
+            bool chunked = transfer_encodings != 0;
+            std::size_t length = 0;
+            if (chunked ? !iequals(trim(transfer_encoding), "chunked") : !body_length(request, length)) {
+                reject(errors().bad_request, "Malformed request body framing");
+                return false;
+            }
+            body_mode_ = BodyMode::None;
+            if (!chunked && length == 0) {
+                return true;
+            }
+            Method request_method = request.method == "GET" ? Method::GET : Method::POST;
+            const Endpoint *endpoint = static_routes.find(request.path, request_method) != nullptr
+                                       ? nullptr : router.find(request.path, request_method, params_);
+            std::size_t limit = endpoint && endpoint->max_body_bytes ? endpoint->max_body_bytes : options.max_body_bytes;
+            if (!chunked && length > limit) {
+                reject(errors().payload_too_large, "Request body is too large");
+                return false;
+            }
+            decoder_.reset(length, chunked, limit);
+            head_length_ = body_end_ = parser_.consumed();
+            if (endpoint && endpoint->stream_handler) {
+                endpoint_ = endpoint->metrics_id;
+                body_mode_ = BodyMode::Stream;
+                start_reader(*endpoint, request);
+                begin_ += head_length_;
+                head_length_ = body_end_ = 0;
+                parser_.reset();
             } else {
-#ifdef DEBUG
-                logger->log(Level::Debug, "file " + filename + " opened successfully");
-#endif
+                body_mode_ = endpoint && (endpoint->handler || endpoint->chunked_handler) ? BodyMode::Buffered : BodyMode::Discard;
             }
-
-            std::string content((std::istreambuf_iterator<char>(file)), (std::istreambuf_iterator<char>()));
-            return content;
+            if (end_ == begin_ + head_length_ && request.version == "HTTP/1.1"
+                && iequals(request.header("Expect"), "100-continue")) {
+                static const std::string go_on = Templates::Responses::CONTINUE();
+                responses_.push_back({&go_on});
+                responses_.back().interim = true;
+            }
+            return true;
         }
 
-        std::string getBody(const std::string& str, Logger::Ptr logger) {
-//            std::string currentPath = std::filesystem::current_path().c_str();  // for easy detect where you are
-//            std::cout << "Current file path: " << currentPath << std::endl;  // for easy detect where you are
-            if (str.substr(0, filePrefix.size()) == filePrefix) {
-                std::string ans = readFileIntoString(str.substr(filePrefix.size()), logger);
-                return ans;
+        /// Decodes the received part of the current request body
+        /// @return true if the body is complete & the request is answered
+        bool read_body() {
+            // the headers stay in front of the body until it is complete, unless it is streamed
+            std::size_t offset = begin_ + body_end_;
+            char *data = buffer_.data() + offset;
+            std::size_t consumed = 0, produced = 0;
+            BodyDecoder::Status status = decoder_.decode(data, end_ - offset, consumed, produced);
+            if (body_mode_ == BodyMode::Stream) {
+                if (reader_ && produced > 0) {
+                    try {
+                        reader_->onData(std::string_view(data, produced));
+                    } catch (...) {
+                        logger->log(Level::Error, "Body reader failed: " + boost::current_exception_diagnostic_information());
+                        reader_.reset();
+                    }
+                }
+                begin_ += consumed;
+            } else {
+                if (body_mode_ == BodyMode::Buffered) {
+                    body_end_ += produced;
+                }
+                // only a completed body leaves raw bytes, those of the next request: move them after the body
+                std::size_t rest = end_ - offset - consumed;
+                std::memmove(buffer_.data() + begin_ + body_end_, data + consumed, rest);
+                end_ = begin_ + body_end_ + rest;
+            }
+            switch (status) {
+                case BodyDecoder::Status::Incomplete:
+                    if (end_ - begin_ == buffer_.size()) {
+                        // a buffered body has filled the buffer
+                        std::size_t needed = decoder_.isChunked()
+                                             ? std::min(buffer_.size() * 2, head_length_ + decoder_.maxSize() + 1)
+                                             : body_end_ + decoder_.remainingSize();
+                        if (needed <= buffer_.size()) {
+                            reject(errors().payload_too_large, "Request body is too large");
+                            return false;
+                        }
+                        buffer_.resize(needed);
+                    }
+                    return false;
+                case BodyDecoder::Status::BadRequest:
+                    reject(errors().bad_request, "Malformed request body");
+                    return false;
+                case BodyDecoder::Status::TooLarge:
+                    reject(errors().payload_too_large, "Request body is too large");
+                    return false;
+                case BodyDecoder::Status::Complete:
+                    break;
+            }
+            BodyMode mode = body_mode_;
+            body_mode_ = BodyMode::None;
+            if (mode == BodyMode::Stream) {
+                finish_reader();
             } else {
-                return str;
+                // the buffer may have moved since the headers were parsed, so their views are taken again
+                parser_.reset();
+                parser_.parse(buffer_.data() + begin_, head_length_);
+                std::string_view body(buffer_.data() + begin_ + head_length_, body_end_ - head_length_);
+                handle_request(parser_.request(), body);
+                begin_ += body_end_;
+                parser_.reset();
             }
+            body_end_ = head_length_ = 0;
+            responses_.back().close = !keep_alive;
+            return true;
         }
-    }// namespace
 
-    class HttpSession : public std::enable_shared_from_this<HttpSession>, Interfaces::HttpSessionInterface {
-    public:
-        HttpSession(boost::asio::ip::tcp::socket socket,
-                    const endpoints &endpoints,
-                    Logger::Ptr logger,
-                    CACHE& cache,
-                    bool enable_cache = true)
-            try : socket_(std::move(socket)), endpoints_(endpoints), logger(logger), cache(cache), enable_cache(enable_cache) {
+        /// Answers every complete request in the buffer (pipelined requests go out with a single write)
+        void handle_buffered() {
 #ifdef DEBUG
-            logger->log(Level::Debug, "HttpSession object created");
+            std::uint64_t allocations = AllocationCounter::count();
 #endif
-        } catch (...) {
-            logger->log(Level::Error, "Failed to create HttpSession object");
-        }
-
-        void start() override {
-            do_read();
-        }
-
-        ~HttpSession() {
+            while (true) {
+                if (body_mode_ != BodyMode::None) {
+                    if (!read_body() || !keep_alive) {
+                        break;
+                    }
+                    continue;
+                }
+                auto parse_start = std::chrono::steady_clock::now();
+                HttpRequestParser::Status status = parser_.parse(buffer_.data() + begin_, end_ - begin_);
+                parse_ns_ += elapsed_ns(parse_start);  // a request may arrive in several reads
+                if (status == HttpRequestParser::Status::Incomplete) {
+                    break;
+                }
+                if (status == HttpRequestParser::Status::Complete) {
+                    const HttpRequest &request = parser_.request();
+                    keep_alive = keep_alive_requested(request) && ++requests_served < options.max_requests;
+                    if (!start_body(request)) {
+                        break;
+                    }
+                    if (body_mode_ != BodyMode::None) {
+                        continue;
+                    }
+                    handle_request(request, {});
+                    responses_.back().close = !keep_alive;
+                    begin_ += parser_.consumed();
+                    parser_.reset();
+                    if (keep_alive) {
+                        continue;
+                    }
+                    break;
+                }
+                if (status == HttpRequestParser::Status::TooLarge) {
+                    reject(errors().headers_too_large, "Request headers are too large");
+                } else {
+                    reject(errors().bad_request, "Malformed request");
+                }
+                break;
+            }
+            if (responses_.empty()) {
+                do_read();
+            } else {
+                do_write();
+            }
 #ifdef DEBUG
-            logger->log(Level::Debug, "HttpSession object destroyed");
+            // 0 in the steady state of in-memory responses, if counting is enabled (see AllocationCounter)
+            logger->log(Level::Debug, "Requests handled with " + std::to_string(AllocationCounter::count() - allocations) + " heap allocations");
 #endif
         }
 
-    private:
         void do_read() {
             auto self = shared_from_this();
-            boost::asio::async_read_until(
-                    socket_, request_, "\r\n\r\n",
-                    [this, self](const boost::system::error_code &ec, std::size_t bytes_transferred) {
+            // move the beginning of a partially read request to the front, the parser keeps only offsets
+            if (begin_ == end_) {
+                begin_ = end_ = 0;
+            } else if (begin_ > 0) {
+                std::memmove(buffer_.data(), buffer_.data() + begin_, end_ - begin_);
+                end_ -= begin_;
+                begin_ = 0;
+            }
+            wait_idle();
+            socket_.async_read_some(
+                    boost::asio::buffer(buffer_.data() + end_, buffer_.size() - end_),
+                    makeAllocHandler(handler_memory_, [this, self](const boost::system::error_code &ec, std::size_t bytes_transferred) {
+                        timer_.expires_at(std::chrono::steady_clock::time_point::max());
                         if (!ec) {
-                            std::istream request_stream(&request_);
-                            std::string request_line;
-                            std::getline(request_stream, request_line);
-
-                            std::istringstream iss(request_line);
-                            std::string method, path, version;
-                            iss >> method >> path >> version;
-
-                            auto it = endpoints_.find(path);
-                            if (it != endpoints_.end() && (method == "GET" ? Method::GET : Method::POST) == it->second.second) {
-#ifdef DEBUG
-                                logger->log(Level::Debug, "Endpoint " + path + " of type " + method + " found");
-#endif
-                                if (enable_cache && cache.find(method) != cache.end()) {
-                                    do_write(cache[method]);
-                                    logger->log(Level::Info, "Endpoint " + path + " of type " + method + " responsing...");
-                                } else {
-                                    std::string body = std::move(getBody(it->second.first, logger));
-                                    std::string response = Templates::Responses::OK(body);
-                                    do_write(response);
-                                    logger->log(Level::Info, "Endpoint " + path + " of type " + method + " responsing...");
-                                    if (enable_cache) {
-                                        cache.insert(std::make_pair(method, response));
+                            Metrics::local().bytes_received.add(bytes_transferred);
+                            end_ += bytes_transferred;
+                            handle_buffered();
+                        } else if (ec == boost::asio::error::eof || ec == boost::asio::error::operation_aborted) {
 #ifdef DEBUG
-                                        logger->log(Level::Debug, "Endpoint " + path + " of type " + method + " added to the cache");
+                            logger->log(Level::Debug, "Connection closed: " + ec.message());
 #endif
-                                    }
-                                }
-                            } else {
-                                do_write(Templates::Responses::NOT_OK());
-                                logger->log(Level::Error, "No endpoint with name " + path + " and method " + method);
-                            }
                         } else {
                             logger->log(Level::Error, "Internal error in do_read() function: " + ec.message());
                         }
-                    });
+                    }));
         }
 
-        void do_write(const std::string &response) {
+        /// Sends the responses_ in the order of the requests: everything in memory up to the next file body goes
+        /// with one gather write, the file body itself - with sendfile
+        void do_write() {
             auto self = shared_from_this();
-            boost::asio::async_write(socket_, boost::asio::buffer(response),
-                                     [this, self](const boost::system::error_code &ec, std::size_t length) {
-                                         if (!ec) {
-                                             boost::system::error_code ignored_ec;
-                                             socket_.shutdown(boost::asio::ip::tcp::socket::shutdown_both, ignored_ec);
-#ifdef DEBUG
-                                             logger->log(Level::Debug, "do_write() ran successfully");
-#endif
-                                         } else {
+            if (write_index_ == 0) {
+                Templates::Headers::DATE(clock, date_.data());
+                write_start_ = std::chrono::steady_clock::now();
+            }
+            // the Date & Connection headers go right after the status line, so cached responses stay as they are
+            buffers_.clear();
+            bool file_follows = false, stream_follows = false;
+            while (write_index_ < responses_.size() && !file_follows && !stream_follows) {
+                const QueuedResponse &queued = responses_[write_index_++];
+                const std::string &response = *queued.head;
+                if (queued.interim) {
+                    buffers_.push_back(boost::asio::buffer(response));
+                    continue;
+                }
+                std::size_t status_line_end = response.find("\r\n") + 2;
+                buffers_.push_back(boost::asio::buffer(response.data(), status_line_end));
+                buffers_.push_back(boost::asio::buffer(date_));
+                buffers_.push_back(boost::asio::buffer(queued.close ? Templates::Headers::CLOSE : Templates::Headers::KEEP_ALIVE));
+                buffers_.push_back(boost::asio::buffer(response.data() + status_line_end, response.size() - status_line_end));
+                if (!queued.body.empty()) {
+                    buffers_.push_back(boost::asio::buffer(queued.body.data(), queued.body.size()));
+                }
+                file_follows = static_cast<bool>(queued.file);
+                stream_follows = static_cast<bool>(queued.stream);
+            }
+            if (file_follows && !corked_) {
+                // hold the headers until the file body joins them in full segments
+                boost::system::error_code ignored_ec;
+                socket_.set_option(tcp_cork(true), ignored_ec);
+                corked_ = !ignored_ec;
+            }
+            boost::asio::async_write(socket_, BufferView(buffers_), makeAllocHandler(handler_memory_,
+                                     [this, self, file_follows, stream_follows](const boost::system::error_code &ec, std::size_t length) {
+                                         Metrics::local().bytes_sent.add(length);
+                                         if (ec) {
                                              logger->log(Level::Error, "Internal boost error of code " + ec.message() + "; Stopping the server.");
+                                         } else if (file_follows) {
+                                             do_sendfile();
+                                         } else if (stream_follows) {
+                                             pump_stream();
+                                         } else {
+                                             finish_write();
                                          }
-                                     });
+                                     }));
+        }
+
+        /// Sends the file body of the last written response, waiting for the socket whenever its buffer is full
+        void do_sendfile() {
+            FileBody &file = responses_[write_index_ - 1].file;
+            boost::system::error_code ec;
+            socket_.native_non_blocking(true, ec);
+            while (!ec && !file.done()) {
+                if (file.sendTo(socket_.native_handle())) {
+                    continue;
+                }
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    auto self = shared_from_this();
+                    socket_.async_wait(boost::asio::ip::tcp::socket::wait_write,
+                                       makeAllocHandler(handler_memory_, [this, self](const boost::system::error_code &ec) {
+                                           if (!ec) {
+                                               do_sendfile();
+                                           } else {
+                                               logger->log(Level::Error, "Internal error in do_sendfile() function: " + ec.message());
+                                           }
+                                       }));
+                    return;
+                }
+                if (errno != EINTR) {
+                    ec.assign(errno, boost::system::system_category());
+                }
+            }
+            if (ec) {
+                logger->log(Level::Error, "Internal error in do_sendfile() function: " + ec.message());
+                boost::system::error_code ignored_ec;
+                socket_.close(ignored_ec);
+            } else {
+                Metrics::local().bytes_sent.add(file.length());
+                if (write_index_ < responses_.size()) {
+                    do_write();
+                } else {
+                    finish_write();
+                }
+            }
+        }
+
+        /// The whole batch is sent: read the next requests or close the connection
+        void finish_write() {
+            // the responses of one write share its time, pipelined requests wait for the whole batch
+            Metrics::Slot &metrics = Metrics::local();
+            std::uint64_t write_ns = elapsed_ns(write_start_);
+            for (const QueuedResponse &queued : responses_) {
+                if (!queued.interim) {
+                    Metrics::EndpointSlot &endpoint = metrics.endpoint(queued.endpoint);
+                    std::size_t status_class = static_cast<std::size_t>((*queued.head)[9] - '1');
+                    endpoint.responses[std::min(status_class, Metrics::STATUS_CLASSES - 1)].add();
+                    endpoint.write.record(write_ns);
+                }
+            }
+            bool close = responses_.back().close;
+            responses_.clear();
+            handler_responses_used_ = 0;
+            write_index_ = 0;
+            if (corked_) {
+                boost::system::error_code ignored_ec;
+                socket_.set_option(tcp_cork(false), ignored_ec);
+                corked_ = false;
+            }
+            if (!close) {
+                do_read();
+            } else {
+                boost::system::error_code ignored_ec;
+                socket_.shutdown(boost::asio::ip::tcp::socket::shutdown_both, ignored_ec);
+#ifdef DEBUG
+                logger->log(Level::Debug, "do_write() ran successfully");
+#endif
+            }
         }
 
+        /// One response waiting to be sent, scatter-gather: a small formatted head, then a body referencing storage
+        /// that outlives the write (static, of an endpoint, a mapping, a cache entry or a handler response)
+        /// or a file body sent with sendfile; bodies are never copied behind their heads
+        struct QueuedResponse {
+            const std::string *head = nullptr;  // the status line & headers, without Date & Connection; the whole
+                                                // 1xx/error response; kept by owner or by the server & its endpoints
+            FileBody file;
+            std::shared_ptr<const void> owner;  // keeps the head & body alive, e.g. a MappedFile or a cache entry
+            std::string_view body;              // a body sent after the head: of a mapping, a variant or a handler
+            bool close = false;     // the last response of the connection
+            bool interim = false;   // a 1xx response, sent as it is
+            std::shared_ptr<ResponseStream::State> stream;  // the body is pushed by a producer, see pump_stream
+            std::uint32_t endpoint = Metrics::UNMATCHED;    // the metrics id of the endpoint that answered
+        };
+
+        /// buffers_ as a buffer sequence: the composed write keeps a copy of its sequence, a copy of the vector
+        /// would be a heap allocation per write
+        struct BufferView {
+            typedef boost::asio::const_buffer value_type;
+            typedef const boost::asio::const_buffer *const_iterator;
+
+            explicit BufferView(const std::vector<boost::asio::const_buffer> &buffers) noexcept
+                : first(buffers.data()), last(buffers.data() + buffers.size()) {}
+
+            const_iterator begin() const noexcept {
+                return first;
+            }
+
+            const_iterator end() const noexcept {
+                return last;
+            }
+
+            const_iterator first;
+            const_iterator last;
+        };
+
+        enum class BodyMode {
+            None,      // no body is being read
+            Buffered,  // decoded right after the headers, for a Handler
+            Discard,   // decoded & dropped, the headers wait in the buffer
+            Stream     // decoded & passed to reader_, the headers are gone
+        };
+
+        HandlerMemory handler_memory_;  // the states of the operations below; declared first, so it outlives them
         boost::asio::ip::tcp::socket socket_;
-        boost::asio::streambuf request_;
-        const endpoints &endpoints_;
+        boost::asio::steady_timer timer_;
+        std::vector<char> buffer_;  // the read buffer; [begin_, end_) are the received but not handled bytes
+        std::size_t begin_ = 0;
+        std::size_t end_ = 0;
+        HttpRequestParser parser_;
+        std::vector<QueuedResponse> responses_;  // kept by the session until the write completes
+        // reused: the first handler_responses_used_ ones are queued; not a deque, it allocates even when empty
+        std::vector<std::unique_ptr<HttpResponse>> handler_responses_;
+        std::size_t handler_responses_used_ = 0;
+        BodyDecoder decoder_;
+        BodyMode body_mode_ = BodyMode::None;
+        std::size_t head_length_ = 0;  // the headers of the request whose body is read, from begin_
+        std::size_t body_end_ = 0;     // the end of the decoded body, from begin_
+        std::unique_ptr<BodyReader> reader_;
+        bool chunk_in_flight_ = false;
+        std::array<char, 2 * sizeof(std::size_t) + 2> chunk_size_;  // the hex size line of the chunk being written
+        std::size_t write_index_ = 0;            // the first response not handed to the socket yet
+        bool corked_ = false;
+        std::vector<boost::asio::const_buffer> buffers_;
+        std::array<char, Templates::Headers::DATE_SIZE> date_;  // shared by all the responses of one write
+        std::chrono::steady_clock::time_point write_start_;
+        std::uint32_t endpoint_ = Metrics::UNMATCHED;  // of the request being handled
+        std::uint64_t parse_ns_ = 0;                   // spent parsing the headers of the next request
+        std::array<std::byte, 1024> arena_buffer_;  // request-scoped data, e.g. log messages; rarely outgrown
+        std::pmr::monotonic_buffer_resource arena_{arena_buffer_.data(), arena_buffer_.size()};
+        bool keep_alive = false;
+        std::size_t requests_served = 0;
+        RouteParams params_;
+        const Router &router;
+        const SessionOptions &options;
+        const Clock &clock;
+        const FileStore &files;
+        const StaticRoutes &static_routes;
         const bool enable_cache;
         Logger::Ptr logger;
-        CACHE& cache;
+        Cache &cache;
+        Admission::Ptr admission;
+        // copies: the session may outlive the options of its server while the io_context is destroyed
+        const std::size_t buffer_size;
+        const std::size_t pool_size;
+    };
+
+    /// A connection over the sessions limit (AdmissionPolicy::Reject): it gets the prebuilt 503 & is closed once
+    /// the client stops sending, so that its request never turns the close into a reset that loses the response
+    class Rejection : public std::enable_shared_from_this<Rejection> {
+    public:
+        static constexpr std::chrono::seconds LINGER{1};  // the time the client gets to read the response
+
+        /// @param response - SERVICE_UNAVAILABLE, without the Date & Connection headers
+        Rejection(boost::asio::ip::tcp::socket socket, std::shared_ptr<const std::string> response, const Clock &clock)
+                : socket(std::move(socket)), timer(this->socket.get_executor()), response(std::move(response)) {
+            Templates::Headers::DATE(clock, date.data());
+        }
+
+        void start() {
+            auto self = shared_from_this();
+            std::size_t status_line_end = response->find("\r\n") + 2;
+            std::array<boost::asio::const_buffer, 4> buffers = {
+                    boost::asio::buffer(response->data(), status_line_end), boost::asio::buffer(date),
+                    boost::asio::buffer(Templates::Headers::CLOSE),
+                    boost::asio::buffer(response->data() + status_line_end, response->size() - status_line_end)};
+            boost::asio::async_write(socket, buffers, [this, self](const boost::system::error_code &ec, std::size_t) {
+                boost::system::error_code ignored_ec;
+                if (ec) {
+                    socket.close(ignored_ec);
+                    return;
+                }
+                socket.shutdown(boost::asio::ip::tcp::socket::shutdown_send, ignored_ec);
+                drain();
+            });
+            timer.expires_after(LINGER);
+            timer.async_wait([this, self](const boost::system::error_code &ec) {
+                if (!ec) {
+                    boost::system::error_code ignored_ec;
+                    socket.close(ignored_ec);
+                }
+            });
+        }
+
+    private:
+        /// Reads & drops whatever the client sends until it closes its side
+        void drain() {
+            socket.async_read_some(boost::asio::buffer(discard), [this, self = shared_from_this()](const boost::system::error_code &ec, std::size_t) {
+                if (!ec) {
+                    drain();
+                    return;
+                }
+                timer.cancel();
+                boost::system::error_code ignored_ec;
+                socket.close(ignored_ec);
+            });
+        }
+
+        boost::asio::ip::tcp::socket socket;
+        boost::asio::steady_timer timer;
+        std::shared_ptr<const std::string> response;
+        std::array<char, Templates::Headers::DATE_SIZE> date;
+        std::array<char, 512> discard;
     };
 
     class HttpServer : Interfaces::HttpServerInterface {
     public:
+        /// @param reuse_port - bind with SO_REUSEPORT, so that several servers (one per core) share the port
+        ///                     and the kernel spreads incoming connections between them
+        /// @param strand_sessions - wrap every session into a strand; only needed if the io_context is run by
+        ///                          several threads
+        /// @param clock - the source of the Date header, already started; without it the server runs its own
         HttpServer(boost::asio::io_context &io_context,
                    Logger::Ptr logger,
-                   CACHE& cache,
+                   Cache &cache,
                    short port = 8080,
-                   bool enable_cache = true)
-                try : acceptor_(io_context, boost::asio::ip::tcp::endpoint(boost::asio::ip::tcp::v4(), port)),
-                      socket_(io_context),
+                   bool enable_cache = true,
+                   bool reuse_port = false,
+                   bool strand_sessions = true,
+                   Clock::Ptr clock = nullptr)
+                try : io_context(io_context),
+                      acceptor_(io_context),
                       enable_cache(enable_cache),
+                      strand_sessions(strand_sessions),
+                      ownClock(!clock),
+                      clock(clock ? clock : std::make_shared<Clock>()),
                       logger(logger),
-                      cache(cache)
+                      cache(cache),
+                      files(io_context, logger),
+                      admission(std::make_shared<Admission>(io_context)),
+                      unavailable(std::make_shared<const std::string>(Templates::Responses::SERVICE_UNAVAILABLE(options.retry_after.count())))
         {
+            if (ownClock) {
+                this->clock->start(io_context);
+            }
+            admission->onResume([this] {
+#ifdef DEBUG
+                this->logger->log(Level::Debug, "Sessions drained, accepting resumed");
+#endif
+                do_accept();
+            });
+            boost::asio::ip::tcp::endpoint endpoint(boost::asio::ip::tcp::v4(), port);
+            acceptor_.open(endpoint.protocol());
+            acceptor_.set_option(boost::asio::ip::tcp::acceptor::reuse_address(true));
+            if (reuse_port) {
+                acceptor_.set_option(Utils::reuse_port(true));
+            }
+            acceptor_.bind(endpoint);
+            acceptor_.listen();
             do_accept();
 #ifdef DEBUG
             logger->log(Level::Debug, "HttpServer object created");
@@ -335,52 +4234,159 @@ namespace Utils {
         }
 
         ~HttpServer() {
+            admission->onResume(nullptr);
+            if (ownClock) {
+                clock->stop();
+            }
 #ifdef DEBUG
             logger->log(Level::Debug, "HttpServer object destroyed");
 #endif
         }
 
-        /// @param path - the endpoint path from the root page, e.g. "/"(root page), "/hello", "data"
+        /// @param path - the endpoint path from the root page, e.g. "/"(root page), "/hello", "/users/:id", "/static/*path"
         /// @param response - the full response page in string format (so generate the text beforehand)
         /// @param method - the method of the request; now "GET" & "POST" supported
         void addEndpoint(const std::string &path, const std::string &response, Method method) override {
-            endpoints_[path] = std::make_pair(response, method);
+            Endpoint endpoint{response};
+            if (response.compare(0, filePrefix.size(), filePrefix) != 0) {
+                // compressed once here, the hot path only picks a variant
+                endpoint.encoded.build(response, "text/html");
+            }
+            if (!add(path, method, std::move(endpoint))) {
+                return;
+            }
+            if (response.compare(0, filePrefix.size(), filePrefix) == 0) {
+                files.add(response.substr(filePrefix.size()));
+            }
+        }
+
+        /// @param path - the endpoint path, see addEndpoint above
+        /// @param handler - builds the response of every request to the endpoint
+        /// @param max_body_bytes - the limit of the buffered request body, 0 for SessionOptions::max_body_bytes
+        void addEndpoint(const std::string &path, Handler handler, Method method, std::size_t max_body_bytes = 0) {
+            add(path, method, Endpoint{std::string(), std::move(handler), nullptr, max_body_bytes});
+        }
+
+        /// @param handler - starts the chunked response of every request to the endpoint
+        void addChunkedEndpoint(const std::string &path, ChunkedHandler handler, Method method, std::size_t max_body_bytes = 0) {
+            add(path, method, Endpoint{std::string(), nullptr, nullptr, max_body_bytes, std::move(handler)});
+        }
+
+        /// @param handler - creates the reader of the body of every request to the endpoint
+        /// @param max_body_bytes - the limit of the streamed request body, 0 for SessionOptions::max_body_bytes
+        void addStreamingEndpoint(const std::string &path, StreamHandler handler, Method method, std::size_t max_body_bytes = 0) {
+            add(path, method, Endpoint{std::string(), nullptr, std::move(handler), max_body_bytes});
+        }
+
+        /// @param table - the routes known at compile time; they are looked up before the other endpoints
+        ///                & replace the previous table
+        template <std::size_t N>
+        void addStaticRoutes(const StaticRouteTable<N> &table) {
+            static_routes.assign(table);
+        }
+
+        /// @param options - the settings of the sessions accepted from now on, the admission limits included
+        void setSessionOptions(const SessionOptions &options) {
+            this->options = options;
+            unavailable = std::make_shared<const std::string>(Templates::Responses::SERVICE_UNAVAILABLE(options.retry_after.count()));
+        }
+
+        /// @return the number of the open sessions
+        std::size_t sessionsCount() const noexcept {
+            return admission->count();
         }
 
         typedef std::shared_ptr<HttpServer> Ptr;
 
     private:
+        /// Routes the endpoint & registers it for the metrics under its pattern
+        /// @return false if the path is invalid
+        bool add(const std::string &path, Method method, Endpoint endpoint) {
+            endpoint.metrics_id = Metrics::instance().endpoint(method, path);
+            if (!router.add(path, method, std::move(endpoint))) {
+                logger->log(Level::Error, "Invalid endpoint path " + path);
+                return false;
+            }
+            return true;
+        }
+
         void do_accept() {
-            acceptor_.async_accept(socket_,
-                                   [this](const boost::system::error_code &ec) {
+            // every accepted socket gets its own strand: sessions run in parallel, callbacks of one session - never
+            boost::asio::any_io_executor executor = strand_sessions
+                    ? boost::asio::any_io_executor(boost::asio::make_strand(io_context))
+                    : boost::asio::any_io_executor(io_context.get_executor());
+            acceptor_.async_accept(executor, makeAllocHandler(accept_memory,
+                                   [this](const boost::system::error_code &ec, boost::asio::ip::tcp::socket socket) {
                                        if (!ec) {
-                                           std::make_shared<HttpSession>(std::move(socket_), endpoints_, logger, cache, enable_cache)->start();
+                                           Metrics::local().accepts.add();
+                                           if (admission->overloaded(options) && options.admission == AdmissionPolicy::Reject) {
+                                               Metrics::local().rejections.add();
+                                               std::make_shared<Rejection>(std::move(socket), unavailable, *clock)->start();
+                                           } else {
+                                               // the session & its control block come from the pool of the thread
+                                               std::allocate_shared<HttpSession>(PoolAllocator<HttpSession>(options.pool_size), std::move(socket), router,
+                                                                                 logger, cache, options, *clock, files, static_routes, admission,
+                                                                                 enable_cache)->start();
+                                           }
 #ifdef DEBUG
                                            logger->log(Level::Debug, "do_accept() ran successfully");
 #endif
                                        } else {
                                            logger->log(Level::Error, "Internal error in do_accept() function: " + ec.message());
                                        }
+                                       if (options.admission == AdmissionPolicy::Pause && admission->overloaded(options) && admission->pause()) {
+                                           // the connections wait in the listen backlog; the last session over the mark resumes
+                                           logger->log(Level::Warning, "Sessions limit reached, accepting paused");
+                                           return;
+                                       }
                                        do_accept();
-                                   });
+                                   }));
         }
 
+        boost::asio::io_context &io_context;
+        HandlerMemory accept_memory;  // one accept is in flight at a time; declared first, so it outlives the acceptor
         boost::asio::ip::tcp::acceptor acceptor_;
-        boost::asio::ip::tcp::socket socket_;
-        endpoints endpoints_;
+        Router router;
+        SessionOptions options;
         const bool enable_cache;
+        const bool strand_sessions;
+        const bool ownClock;
+        Clock::Ptr clock;
         Logger::Ptr logger;
-        CACHE& cache;
+        Cache &cache;
+        StaticRoutes static_routes;
+        FileStore files;
+        Admission::Ptr admission;  // shared with the sessions
+        std::shared_ptr<const std::string> unavailable;  // the 503 of AdmissionPolicy::Reject, shared with the rejected connections
     };
 
     class RESTAPIAPP : Interfaces::RESTAPIAPPInterface {
     public:
-        RESTAPIAPP(uint32_t port = 8080, const std::string& logfileName="log.txt")
-        try {
-            logger = std::make_shared<Logger>(logfileName);
-            server = std::make_shared<HttpServer>(io_context, logger, cache, port);
+        /// @param port - the port to listen on
+        /// @param logfileName - the file to write logs into
+        /// @param threads - the number of worker threads (0 is treated as 1)
+        /// @param mode - SharedPool: all the threads run one io_context;
+        ///               PerCore: every thread runs its own io_context, acceptor, cache & logger (shared-nothing)
+        RESTAPIAPP(uint32_t port = 8080, const std::string& logfileName="log.txt",
+                   unsigned threads = std::thread::hardware_concurrency(),
+                   ThreadingMode mode = ThreadingMode::SharedPool)
+        try : threads(std::max(threads, 1u)), mode(mode) {
+            std::size_t shards_count = mode == ThreadingMode::PerCore ? this->threads : 1;
+            for (std::size_t i = 0; i < shards_count; ++i) {
+                // a single-threaded io_context may skip its internal locking
+                shards.push_back(std::make_unique<Shard>(mode == ThreadingMode::PerCore ? 1 : this->threads));
+                shards.back()->cache.setCapacity(cacheCapacity / shards_count);
+                Shard &shard = *shards.back();
+                shard.clock->start(shard.io_context);
+                shard.logger = std::make_shared<Logger>(logfileName);
+                shard.logger->setClock(shard.clock);
+                shard.server = std::make_shared<HttpServer>(shard.io_context, shard.logger, shard.cache, port, true,
+                                                            mode == ThreadingMode::PerCore,
+                                                            mode == ThreadingMode::SharedPool && this->threads > 1,
+                                                            shard.clock);
+            }
 #ifdef DEBUG
-            logger->log(Level::Debug, "RESTAPIAPP object created");
+            shards.front()->logger->log(Level::Debug, "RESTAPIAPP object created");
 #endif
         } catch (...) {
             std::cerr << getPrefix(Level::Critical) << " Failed to build RESTAPIAPP object";
@@ -388,35 +4394,163 @@ namespace Utils {
 
         ~RESTAPIAPP() {
 #ifdef DEBUG
-            logger->log(Level::Debug, "RESTAPIAPP object destroyed");
+            shards.front()->logger->log(Level::Debug, "RESTAPIAPP object destroyed");
 #endif
         }
 
         void AddEndpoint(const std::string &path, const std::string &response, const std::string &method="GET") override {
 #ifdef DEBUG
-            logger->log(Level::Debug, "Enpoint " + path + " with method " + method + " added");
+            shards.front()->logger->log(Level::Debug, "Enpoint " + path + " with method " + method + " added");
 #endif
-            server->addEndpoint(path, response, method == "GET" ? Method::GET : Method::POST);
+            for (auto &shard : shards) {
+                shard->server->addEndpoint(path, response, method == "GET" ? Method::GET : Method::POST);
+            }
+        }
+
+        /// @param handler - builds the response of every request to the endpoint, see RequestView & HttpResponse
+        /// @param max_body_bytes - the limit of the request body, buffered for the handler; 0 for the default
+        void AddEndpoint(const std::string &path, const Handler &handler, const std::string &method="GET",
+                         std::size_t max_body_bytes = 0) {
+            for (auto &shard : shards) {
+                shard->server->addEndpoint(path, handler, method == "GET" ? Method::GET : Method::POST, max_body_bytes);
+            }
+        }
+
+        /// @param handler - creates a BodyReader per request: it gets the body in pieces as they arrive
+        /// @param max_body_bytes - the limit of the request body; 0 for the default
+        void AddStreamingEndpoint(const std::string &path, const StreamHandler &handler, const std::string &method="POST",
+                                  std::size_t max_body_bytes = 0) {
+            for (auto &shard : shards) {
+                shard->server->addStreamingEndpoint(path, handler, method == "GET" ? Method::GET : Method::POST, max_body_bytes);
+            }
         }
 
+        /// @param handler - sends the response with Transfer-Encoding: chunked, pushing the body as it is produced,
+        ///                  see ResponseStream; nothing is buffered beyond the chunks waiting for the socket
+        void AddChunkedEndpoint(const std::string &path, const ChunkedHandler &handler, const std::string &method="GET",
+                                std::size_t max_body_bytes = 0) {
+            for (auto &shard : shards) {
+                shard->server->addChunkedEndpoint(path, handler, method == "GET" ? Method::GET : Method::POST, max_body_bytes);
+            }
+        }
+
+        /// @param bytes - the default limit of a request body
+        void SetMaxBodySize(std::size_t bytes) {
+            options.max_body_bytes = bytes;
+            for (auto &shard : shards) {
+                shard->server->setSessionOptions(options);
+            }
+        }
+
+        /// @param table - the routes known at compile time, see StaticRouteTable
+        template <std::size_t N>
+        void AddStaticRoutes(const StaticRouteTable<N> &table) {
+            for (auto &shard : shards) {
+                shard->server->addStaticRoutes(table);
+            }
+        }
+
+        /// @param max_requests - the number of requests served over one connection before it is closed
+        /// @param idle_timeout - the time a persistent connection may wait for the next request
+        void SetKeepAlive(std::size_t max_requests, std::chrono::milliseconds idle_timeout) {
+            options.max_requests = max_requests;
+            options.idle_timeout = idle_timeout;
+            for (auto &shard : shards) {
+                shard->server->setSessionOptions(options);
+            }
+        }
+
+        /// @param enabled - serve @file: endpoints from memory mappings refreshed by inotify (default),
+        ///                  otherwise keep the small files in the responses cache until they are evicted or changed
+        ///                  & send the larger ones with sendfile, opening them per request
+        void SetFileMapping(bool enabled) {
+            options.map_files = enabled;
+            for (auto &shard : shards) {
+                shard->server->setSessionOptions(options);
+            }
+        }
+
+        /// @param high_water - the number of closed sessions & their read buffers every worker thread keeps
+        ///                     for the next connections; 0 frees them at once
+        void SetSessionPool(std::size_t high_water) {
+            options.pool_size = high_water;
+            for (auto &shard : shards) {
+                shard->server->setSessionOptions(options);
+            }
+        }
+
+        /// Serves the metrics of the whole process in the Prometheus text format (see Metrics)
+        /// @param path - the endpoint scraped by Prometheus
+        void EnableMetrics(const std::string &path = "/metrics") {
+            AddEndpoint(path, [](const RequestView &, HttpResponse &response) {
+                response.setContentType("text/plain; version=0.0.4");
+                response.write(Metrics::instance().scrape());
+            });
+        }
+
+        /// @param max_sessions - the concurrent connections of the server, 0 for no limit; in the PerCore mode
+        ///                       it is split between the cores
+        /// @param policy - pause accepting or answer the connections over the limit with 503 & Retry-After
+        /// @param low_water - the limit is lifted when the sessions drain to it; 0 for 90% of max_sessions
+        void SetMaxSessions(std::size_t max_sessions, AdmissionPolicy policy = AdmissionPolicy::Pause, std::size_t low_water = 0,
+                            std::chrono::seconds retry_after = std::chrono::seconds(1)) {
+            options.max_sessions = max_sessions == 0 ? 0 : std::max<std::size_t>(max_sessions / shards.size(), 1);
+            options.sessions_low_water = low_water / shards.size();
+            options.admission = policy;
+            options.retry_after = retry_after;
+            for (auto &shard : shards) {
+                shard->server->setSessionOptions(options);
+            }
+        }
+
+        /// Moves the file & syslog writes to a background thread per logger (see Logger::enableAsync)
+        /// @param policy - what happens to the records that do not fit into the full ring
+        void SetAsyncLogging(OverflowPolicy policy = OverflowPolicy::Drop) {
+            for (auto &shard : shards) {
+                shard->logger->enableAsync(policy);
+            }
+        }
+
+        /// @param bytes - the memory budget of the responses cache; in the PerCore mode it is split between the cores
+        void SetCacheCapacity(std::size_t bytes) {
+            cacheCapacity = bytes;
+            for (auto &shard : shards) {
+                shard->cache.setCapacity(cacheCapacity / shards.size());
+            }
+        }
+
+        /// Blocks until the server is stopped; the calling thread becomes one of the worker threads
         void RunServer() noexcept override {
             std::string exception_message = "Failed to run the server; ";
+            Logger::Ptr logger = shards.front()->logger;
+            std::vector<std::thread> workers;
             try {
-                io_context.run();
-                logger->log(Level::Info, "Server starting");
+                logger->log(Level::Info, "Server starting on " + std::to_string(threads) + " thread(s)");
+                workers.reserve(threads - 1);
+                for (unsigned i = 1; i < threads; ++i) {
+                    workers.emplace_back([this, i] { runWorker(i); });
+                }
+                runWorker(0);
             } catch (const std::exception &e) {
+                stopShards();
                 logger->log(Level::Critical, exception_message + e.what());
             } catch (const boost::exception &e) {
+                stopShards();
                 logger->log(Level::Critical, exception_message + boost::diagnostic_information(e));
             } catch (...) {
+                stopShards();
                 logger->log(Level::Critical, exception_message);
             }
+            for (auto &worker : workers) {
+                worker.join();
+            }
         }
 
         void StopServer() noexcept override {
             std::string exception_message = "Failed to stop the server; ";
+            Logger::Ptr logger = shards.front()->logger;
             try {
-                io_context.stop();
+                stopShards();
                 logger->log(Level::Info, "Server stopping");
             } catch (const std::exception &e) {
                 logger->log(Level::Critical, exception_message + e.what());
@@ -428,13 +4562,101 @@ namespace Utils {
         }
 
     private:
-        boost::asio::io_context io_context;
-        HttpServer::Ptr server;
-        Logger::Ptr logger;
-        CACHE cache;  // @TODO later: wrap into a separate class & make it LRU cache, now possible memory overflow
+        /// Everything owned by one io_context; in the PerCore mode there is one shard per worker thread
+        struct Shard {
+            // a cache of a single-threaded shard needs no lock sharding
+            explicit Shard(int concurrency_hint) : io_context(concurrency_hint), clock(std::make_shared<Clock>()),
+                                                   cache(0, concurrency_hint > 1 ? 16 : 1) {}
+
+            // the clock may outlive the shard inside the logger, but its timer must not outlive the io_context
+            ~Shard() {
+                clock->stop();
+            }
+
+            boost::asio::io_context io_context;
+            Clock::Ptr clock;
+            Logger::Ptr logger;
+            Cache cache;
+            HttpServer::Ptr server;
+        };
+
+        void stopShards() noexcept {
+            for (auto &shard : shards) {
+                shard->io_context.stop();
+            }
+        }
+
+        /// @param index - the index of the worker thread
+        void runWorker(unsigned index) noexcept {
+            Shard &shard = mode == ThreadingMode::PerCore ? *shards[index] : *shards.front();
+            std::string exception_message = "Worker thread failed; ";
+            try {
+                if (mode == ThreadingMode::PerCore) {
+                    pinToCore(index);
+                }
+                shard.io_context.run();
+            } catch (const std::exception &e) {
+                shard.logger->log(Level::Critical, exception_message + e.what());
+            } catch (const boost::exception &e) {
+                shard.logger->log(Level::Critical, exception_message + boost::diagnostic_information(e));
+            } catch (...) {
+                shard.logger->log(Level::Critical, exception_message);
+            }
+        }
+
+        /// Keeps the shard on one core, so its memory stays in that core's caches; failure is not critical
+        void pinToCore(unsigned index) noexcept {
+            unsigned cores = std::max(std::thread::hardware_concurrency(), 1u);
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(index % cores, &set);
+            if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+                shards[index]->logger->log(Level::Warning, "Failed to pin worker thread " + std::to_string(index) + " to a core");
+            }
+        }
+
+        const unsigned threads;
+        const ThreadingMode mode;
+        SessionOptions options;
+        std::size_t cacheCapacity = 64 * 1024 * 1024;
+        std::vector<std::unique_ptr<Shard>> shards;
     };
 }// namespace Utils
 
+#ifdef SERVEME_COUNT_ALLOCATIONS
+// the replacements pair malloc with free, GCC only sees their names mismatch
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+void *operator new(std::size_t size) {
+    ++Utils::AllocationCounter::allocations;
+    if (void *pointer = std::malloc(size == 0 ? 1 : size)) {
+        return pointer;
+    }
+    throw std::bad_alloc();
+}
+
+void *operator new[](std::size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void *pointer) noexcept {
+    std::free(pointer);
+}
+
+void operator delete[](void *pointer) noexcept {
+    std::free(pointer);
+}
+
+void operator delete(void *pointer, std::size_t) noexcept {
+    std::free(pointer);
+}
+
+void operator delete[](void *pointer, std::size_t) noexcept {
+    std::free(pointer);
+}
+#pragma GCC diagnostic pop
+#endif
+
 
 ///// Usage Example /////
 /*
@@ -447,6 +4669,14 @@ int main()
     app.AddEndpoint("/data", "Some data!", "GET");
     app.AddEndpoint("/data_from_file", "@file:/Users/egorfortov/CLionProjects/HTTP_Server_Egor_Fortov/index.html", "GET");  // better to set full path
     app.AddEndpoint("/submit", "Submitted!", "POST");
+    app.AddEndpoint("/users/:id", "A user", "GET");  // matches "/users/42", "/users/42?fields=name", ...
+    app.AddEndpoint("/hello/:name", [](const RequestView &request, HttpResponse &response) {
+        response.write("Hello, ");
+        response.write(request.param("name"));
+    });
+    static constexpr StaticRoute routes[] = {{"/health", "OK"}, {"/version", "1.0", Method::GET, "text/plain"}};
+    static constexpr auto table = makeStaticRoutes(routes);  // the perfect hash is found by the compiler
+    app.AddStaticRoutes(table);
     app.RunServer();
 
     return 0;
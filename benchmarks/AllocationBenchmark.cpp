@@ -0,0 +1,111 @@
+///// ALLOCATION BENCHMARK /////
+// Sends keep-alive requests to an HttpServer over loopback & counts the heap allocations the server thread makes
+// per request (allocs_per_request, see AllocationCounter); the steady state of in-memory responses makes none
+// The server runs on one thread without strands, as a shard of the PerCore mode does
+// Build: g++ -std=c++17 -O2 -I.. AllocationBenchmark.cpp -o AllocationBenchmark -lbenchmark -lpthread
+// Dependency libraries: boost lib, google benchmark
+////////////////////////////////////
+
+#define SERVEME_COUNT_ALLOCATIONS  // replaces the global operator new in this translation unit
+#include "ServeMe.hpp"
+#include <benchmark/benchmark.h>
+#include <future>
+#include <limits>
+
+namespace {
+    constexpr short PORT = 18090;
+
+    constexpr Utils::StaticRoute routes[] = {{"/health", "OK"}};
+    constexpr auto table = Utils::makeStaticRoutes(routes);
+
+    /// The server under test, on its own thread for the whole run
+    class Server {
+    public:
+        Server() : io_context(1), logger(std::make_shared<Utils::Logger>("AllocationBenchmark", "/dev/null", false)),
+                   server(std::make_shared<Utils::HttpServer>(io_context, logger, cache, PORT, true, false, false)) {
+            server->addEndpoint("/data", "Some data!", Utils::Method::GET);
+            server->addEndpoint("/hello/:name", [](const Utils::RequestView &request, Utils::HttpResponse &response) {
+                response.write("Hello, ");
+                response.write(request.param("name"));
+            }, Utils::Method::GET);
+            server->addStaticRoutes(table);
+            Utils::SessionOptions options;
+            options.max_requests = std::numeric_limits<std::size_t>::max();  // one connection for the whole run
+            server->setSessionOptions(options);
+            thread = std::thread([this] { io_context.run(); });
+        }
+
+        ~Server() {
+            io_context.stop();
+            thread.join();
+        }
+
+        /// @return the number of the allocations of the server thread so far
+        std::uint64_t allocations() {
+            std::promise<std::uint64_t> count;
+            boost::asio::post(io_context, [&count] { count.set_value(Utils::AllocationCounter::count()); });
+            return count.get_future().get();
+        }
+
+    private:
+        boost::asio::io_context io_context;
+        Utils::Cache cache;
+        Utils::Logger::Ptr logger;
+        Utils::HttpServer::Ptr server;
+        std::thread thread;
+    };
+
+    Server &server() {
+        static Server instance;
+        return instance;
+    }
+
+    /// Reads one response with a Content-Length body
+    void readResponse(boost::asio::ip::tcp::socket &socket, std::string &buffer) {
+        buffer.clear();
+        std::size_t head_end = std::string::npos;
+        std::size_t length = 0;
+        char chunk[4096];
+        while (head_end == std::string::npos || buffer.size() < head_end + length) {
+            buffer.append(chunk, socket.read_some(boost::asio::buffer(chunk)));
+            if (head_end == std::string::npos && (head_end = buffer.find("\r\n\r\n")) != std::string::npos) {
+                head_end += 4;
+                std::size_t header = buffer.find("Content-Length: ");
+                length = std::stoul(buffer.substr(header + 16));
+            }
+        }
+    }
+
+    void KeepAliveRequests(benchmark::State &state) {
+        static const char *requests[] = {
+                "GET /data HTTP/1.1\r\nHost: localhost\r\n\r\n",
+                "GET /health HTTP/1.1\r\nHost: localhost\r\n\r\n",
+                "GET /hello/world HTTP/1.1\r\nHost: localhost\r\n\r\n",
+        };
+        std::string_view request = requests[state.range(0)];
+        Server &target = server();
+        boost::asio::io_context client;
+        boost::asio::ip::tcp::socket socket(client);
+        socket.connect({boost::asio::ip::address_v4::loopback(), static_cast<unsigned short>(PORT)});
+        std::string buffer;
+        buffer.reserve(4096);
+        // warm up: the first requests of a connection grow its buffers
+        for (int i = 0; i < 16; ++i) {
+            boost::asio::write(socket, boost::asio::buffer(request));
+            readResponse(socket, buffer);
+        }
+        std::uint64_t before = target.allocations();
+        for (auto _ : state) {
+            boost::asio::write(socket, boost::asio::buffer(request));
+            readResponse(socket, buffer);
+        }
+        std::uint64_t after = target.allocations();
+        state.counters["allocs_per_request"] = static_cast<double>(after - before) / static_cast<double>(state.iterations());
+        state.SetItemsProcessed(state.iterations());
+    }
+}// namespace
+
+// 0: string endpoint, 1: static route, 2: handler
+BENCHMARK(KeepAliveRequests)->Arg(0)->Arg(1)->Arg(2)->UseRealTime();
+
+BENCHMARK_MAIN();
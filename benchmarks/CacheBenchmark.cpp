@@ -0,0 +1,127 @@
+///// CACHE BENCHMARK /////
+// Get & put of the responses cache under contention, 1 to 16 threads on one shared cache: the unordered_map
+// behind one mutex the server used to keep (CACHE) against the sharded LRU Cache
+// items_per_second is the total over the threads
+// Build: g++ -std=c++17 -O2 -I.. CacheBenchmark.cpp -o CacheBenchmark -lbenchmark -lpthread
+// Dependency libraries: boost lib, google benchmark
+/////////////////////////
+
+#include "ServeMe.hpp"
+#include <benchmark/benchmark.h>
+#include <unordered_map>
+
+namespace {
+    constexpr std::size_t KEYS = 1024;
+
+    const std::vector<std::string> &paths() {
+        static const std::vector<std::string> paths = [] {
+            std::vector<std::string> paths;
+            for (std::size_t i = 0; i < KEYS; ++i) {
+                paths.push_back("/api/v1/resource" + std::to_string(i));
+            }
+            return paths;
+        }();
+        return paths;
+    }
+
+    const Utils::Cache::Value &body() {
+        static const Utils::Cache::Value body = [] {
+            auto response = std::make_shared<Utils::Cache::Response>();
+            response->body.assign(512, 'x');
+            response->encoded.build(response->body, "text/html");
+            return response;
+        }();
+        return body;
+    }
+
+    /// One mutex over the whole map, the key is the path
+    struct LockedMap {
+        LockedMap() {
+            for (const std::string &path : paths()) {
+                map[path] = Utils::Templates::Responses::OK(body()->body);
+            }
+        }
+
+        std::mutex mutex;
+        std::unordered_map<std::string, std::string> map;
+    };
+
+    LockedMap &lockedMap() {
+        static LockedMap cache;
+        return cache;
+    }
+
+    /// The sharded cache holding every key
+    struct FilledCache {
+        FilledCache() {
+            for (const std::string &path : paths()) {
+                cache.put("GET", path, body());
+            }
+        }
+
+        Utils::Cache cache;
+    };
+
+    Utils::Cache &cache() {
+        static FilledCache cache;
+        return cache.cache;
+    }
+
+    /// A thread-local walk over the keys, different for every thread
+    std::size_t nextKey(std::size_t &state) {
+        state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+        return (state >> 33) % KEYS;
+    }
+
+    void LockedMapGet(benchmark::State &state) {
+        LockedMap &map = lockedMap();
+        std::size_t seed = state.thread_index();
+        for (auto _ : state) {
+            const std::string &path = paths()[nextKey(seed)];
+            std::lock_guard lock(map.mutex);
+            // the body was copied out of the map for every request
+            std::string response = map.map.find(path)->second;
+            benchmark::DoNotOptimize(response);
+        }
+        state.SetItemsProcessed(state.iterations());
+    }
+
+    void CacheGet(benchmark::State &state) {
+        Utils::Cache &target = cache();
+        std::size_t seed = state.thread_index();
+        for (auto _ : state) {
+            Utils::Cache::Value value = target.get("GET", paths()[nextKey(seed)]);
+            benchmark::DoNotOptimize(value);
+        }
+        state.SetItemsProcessed(state.iterations());
+    }
+
+    /// 90% hits, 10% puts of fresh keys, each of them evicts the least recently used entry of its shard
+    void CacheMixed(benchmark::State &state) {
+        // the budget of 1024 entries: every put is followed by an eviction
+        static Utils::Cache target(KEYS * (512 + 128));
+        std::size_t seed = state.thread_index();
+        std::string path;
+        std::size_t serial = 0;
+        for (auto _ : state) {
+            std::size_t key = nextKey(seed);
+            if (key % 10 == 0) {
+                path.assign("/fresh/").append(std::to_string(state.thread_index())).append("/").append(std::to_string(serial++));
+                target.put("GET", path, body());
+            } else {
+                Utils::Cache::Value value = target.get("GET", paths()[key]);
+                if (!value) {
+                    target.put("GET", paths()[key], body());
+                }
+                benchmark::DoNotOptimize(value);
+            }
+        }
+        state.SetItemsProcessed(state.iterations());
+    }
+}// namespace
+
+BENCHMARK(LockedMapGet)->ThreadRange(1, 16)->UseRealTime();
+BENCHMARK(CacheGet)->ThreadRange(1, 16)->UseRealTime();
+BENCHMARK(CacheMixed)->ThreadRange(1, 16)->UseRealTime();
+
+BENCHMARK_MAIN();
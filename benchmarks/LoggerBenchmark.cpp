@@ -0,0 +1,64 @@
+///// LOGGER BENCHMARK /////
+// Logger::log throughput from 1 to 8 threads: synchronous, asynchronous waiting for the flusher (the sustained
+// rate) or asynchronous dropping (the cost for the caller, see Logger::enableAsync), with or without syslog
+// The file is /dev/null, so the cost of the logger itself is measured, not of the disk
+// items_per_second is the total over the threads; dropped counts the records lost by a full ring
+// Build: g++ -std=c++17 -O2 -I.. LoggerBenchmark.cpp -o LoggerBenchmark -lbenchmark -lpthread
+// Dependency libraries: boost lib, google benchmark
+//////////////////////////
+
+#include "ServeMe.hpp"
+#include <benchmark/benchmark.h>
+
+namespace {
+    /// The loggers of all the configurations, shared by the threads of a run as the sessions of a server share theirs
+    enum Mode {
+        SYNC = 0,
+        ASYNC_BLOCK,
+        ASYNC_DROP,
+        MODES
+    };
+
+    struct Loggers {
+        Loggers() {
+            for (int mode = 0; mode < MODES; ++mode) {
+                for (int syslog = 0; syslog < 2; ++syslog) {
+                    auto &logger = loggers[mode * 2 + syslog];
+                    logger = std::make_unique<Utils::Logger>("LoggerBenchmark", "/dev/null", syslog != 0);
+                    // the servers stamp the records with the cached clock, not with localtime_r
+                    logger->setClock(clock);
+                    if (mode == ASYNC_BLOCK) {
+                        logger->enableAsync(Utils::OverflowPolicy::Block);
+                    } else if (mode == ASYNC_DROP) {
+                        logger->enableAsync(Utils::OverflowPolicy::Drop);
+                    }
+                }
+            }
+        }
+
+        Utils::Clock::Ptr clock = std::make_shared<Utils::Clock>();
+        std::array<std::unique_ptr<Utils::Logger>, MODES * 2> loggers;
+    };
+
+    Utils::Logger &logger(std::int64_t mode, bool syslog) {
+        static Loggers loggers;
+        return *loggers.loggers[mode * 2 + syslog];
+    }
+
+    /// Arguments: Mode, 0/1 - without/with syslog
+    void LoggerLog(benchmark::State &state) {
+        Utils::Logger &target = logger(state.range(0), state.range(1) != 0);
+        std::uint64_t dropped = target.droppedCount();
+        for (auto _ : state) {
+            target.log(Utils::Level::Info, "Endpoint /api/v1/resource of type GET responsing...");
+        }
+        state.SetItemsProcessed(state.iterations());
+        if (state.thread_index() == 0) {
+            state.counters["dropped"] = static_cast<double>(target.droppedCount() - dropped);
+        }
+    }
+}// namespace
+
+BENCHMARK(LoggerLog)->ArgsProduct({{SYNC, ASYNC_BLOCK, ASYNC_DROP}, {0, 1}})->ThreadRange(1, 8)->UseRealTime();
+
+BENCHMARK_MAIN();
@@ -0,0 +1,66 @@
+///// METRICS BENCHMARK /////
+// The cost of recording into Metrics from 1 to 8 threads: a counter, a latency histogram & the clock reads
+// around a measured phase, as the sessions record them per request; and the cost of one scrape
+// Build: g++ -std=c++17 -O2 -I.. MetricsBenchmark.cpp -o MetricsBenchmark -lbenchmark -lpthread
+// Dependency libraries: boost lib, google benchmark
+///////////////////////////
+
+#include "ServeMe.hpp"
+#include <benchmark/benchmark.h>
+
+namespace {
+    std::uint32_t endpointId() {
+        static const std::uint32_t id = Utils::Metrics::instance().endpoint(Utils::Method::GET, "/api/v1/resource");
+        return id;
+    }
+
+    void CounterAdd(benchmark::State &state) {
+        for (auto _ : state) {
+            Utils::Metrics::local().bytes_sent.add(512);
+        }
+        state.SetItemsProcessed(state.iterations());
+    }
+
+    void HistogramRecord(benchmark::State &state) {
+        std::uint32_t id = endpointId();
+        std::uint64_t nanoseconds = 1;
+        for (auto _ : state) {
+            Utils::Metrics::local().endpoint(id).handler.record(nanoseconds);
+            nanoseconds = nanoseconds * 3 % 1000003;  // spread over the buckets
+        }
+        state.SetItemsProcessed(state.iterations());
+    }
+
+    /// Two clock reads & a record: what a measured phase of a request costs
+    void TimedPhase(benchmark::State &state) {
+        std::uint32_t id = endpointId();
+        for (auto _ : state) {
+            auto start = std::chrono::steady_clock::now();
+            auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+            Utils::Metrics::local().endpoint(id).parse.record(static_cast<std::uint64_t>(elapsed.count()));
+        }
+        state.SetItemsProcessed(state.iterations());
+    }
+
+    /// Arguments: the number of endpoints with recorded requests
+    void Scrape(benchmark::State &state) {
+        Utils::Metrics &metrics = Utils::Metrics::instance();
+        for (std::int64_t i = 0; i < state.range(0); ++i) {
+            std::uint32_t id = metrics.endpoint(Utils::Method::GET, "/scraped/" + std::to_string(i));
+            Utils::Metrics::local().endpoint(id).responses[1].add();
+            Utils::Metrics::local().endpoint(id).write.record(static_cast<std::uint64_t>(i) * 1000);
+        }
+        for (auto _ : state) {
+            std::string text = metrics.scrape();
+            benchmark::DoNotOptimize(text);
+        }
+        state.SetItemsProcessed(state.iterations());
+    }
+}// namespace
+
+BENCHMARK(CounterAdd)->ThreadRange(1, 8)->UseRealTime();
+BENCHMARK(HistogramRecord)->ThreadRange(1, 8)->UseRealTime();
+BENCHMARK(TimedPhase)->ThreadRange(1, 8)->UseRealTime();
+BENCHMARK(Scrape)->Arg(10)->Arg(100);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,95 @@
+///// REQUEST PARSER BENCHMARK /////
+// Compares the stream-based parsing of the request line & headers (the way HttpSession::do_read used to do it)
+// with HttpRequestParser; both run on one thread, so items_per_second is requests per second per core
+// Build: g++ -std=c++17 -O2 -I.. ParserBenchmark.cpp -o ParserBenchmark -lbenchmark -lpthread
+// Dependency libraries: boost lib, google benchmark
+////////////////////////////////////
+
+#include "ServeMe.hpp"
+#include <benchmark/benchmark.h>
+
+namespace {
+    const std::string shortRequest = "GET /data HTTP/1.1\r\nHost: localhost:8080\r\n\r\n";
+    const std::string browserRequest =
+            "GET /data_from_file HTTP/1.1\r\n"
+            "Host: localhost:8080\r\n"
+            "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:124.0) Gecko/20100101 Firefox/124.0\r\n"
+            "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n"
+            "Accept-Language: en-US,en;q=0.5\r\n"
+            "Accept-Encoding: gzip, deflate, br\r\n"
+            "Connection: keep-alive\r\n"
+            "Upgrade-Insecure-Requests: 1\r\n"
+            "Sec-Fetch-Dest: document\r\n"
+            "Sec-Fetch-Mode: navigate\r\n"
+            "\r\n";
+
+    const std::string &requestFor(const benchmark::State &state) {
+        return state.range(0) == 0 ? shortRequest : browserRequest;
+    }
+
+    void StreamParsing(benchmark::State &state) {
+        const std::string &raw = requestFor(state);
+        for (auto _ : state) {
+            boost::asio::streambuf request;
+            std::ostream(&request) << raw;
+            std::istream request_stream(&request);
+            std::string request_line;
+            std::getline(request_stream, request_line);
+
+            std::istringstream iss(request_line);
+            std::string method, path, version;
+            iss >> method >> path >> version;
+
+            std::string line;
+            bool keep_alive = false;
+            while (std::getline(request_stream, line) && line != "\r") {
+                std::size_t colon = line.find(':');
+                if (colon != std::string::npos && line.compare(0, colon, "Connection") == 0) {
+                    keep_alive = line.find("keep-alive", colon) != std::string::npos;
+                }
+            }
+            benchmark::DoNotOptimize(path);
+            benchmark::DoNotOptimize(keep_alive);
+        }
+        state.SetItemsProcessed(state.iterations());
+        state.SetBytesProcessed(state.iterations() * raw.size());
+    }
+
+    void ParserParsing(benchmark::State &state) {
+        const std::string &raw = requestFor(state);
+        Utils::HttpRequestParser parser;
+        for (auto _ : state) {
+            parser.reset();
+            auto status = parser.parse(raw.data(), raw.size());
+            const Utils::HttpRequest &request = parser.request();
+            bool keep_alive = request.header("Connection") == "keep-alive";
+            benchmark::DoNotOptimize(status);
+            benchmark::DoNotOptimize(request.target);
+            benchmark::DoNotOptimize(keep_alive);
+        }
+        state.SetItemsProcessed(state.iterations());
+        state.SetBytesProcessed(state.iterations() * raw.size());
+    }
+
+    /// The request arrives split into small segments, every segment resumes the parsing
+    void ParserPartialReads(benchmark::State &state) {
+        const std::string &raw = browserRequest;
+        const std::size_t segment = state.range(0);
+        Utils::HttpRequestParser parser;
+        for (auto _ : state) {
+            parser.reset();
+            auto status = Utils::HttpRequestParser::Status::Incomplete;
+            for (std::size_t size = segment; status == Utils::HttpRequestParser::Status::Incomplete; size += segment) {
+                status = parser.parse(raw.data(), std::min(size, raw.size()));
+            }
+            benchmark::DoNotOptimize(status);
+        }
+        state.SetItemsProcessed(state.iterations());
+    }
+}// namespace
+
+BENCHMARK(StreamParsing)->Arg(0)->Arg(1);
+BENCHMARK(ParserParsing)->Arg(0)->Arg(1);
+BENCHMARK(ParserPartialReads)->Arg(16)->Arg(64)->Arg(256);
+
+BENCHMARK_MAIN();
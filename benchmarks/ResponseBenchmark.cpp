@@ -0,0 +1,68 @@
+///// RESPONSE BENCHMARK /////
+// Building a response for bodies of 16 bytes to 1 MiB: the whole response formatted per request with
+// Templates::Responses::OK (the way the sessions used to answer) against the prebuilt head & the referenced body
+// gathered into one write, as HttpSession::do_write does now; the variant choice by Accept-Encoding is measured too
+// Build: g++ -std=c++17 -O2 -I.. ResponseBenchmark.cpp -o ResponseBenchmark -lbenchmark -lpthread
+//        add -DSERVEME_WITH_ZLIB -lz (see EncodedVariants) for the compressed variants to choose from
+// Dependency libraries: boost lib, google benchmark
+////////////////////////////
+
+#include "ServeMe.hpp"
+#include <benchmark/benchmark.h>
+
+namespace {
+    void ConcatenatedResponse(benchmark::State &state) {
+        const std::string body(static_cast<std::size_t>(state.range(0)), 'x');
+        for (auto _ : state) {
+            std::string response = Utils::Templates::Responses::OK(body);
+            benchmark::DoNotOptimize(response);
+        }
+        state.SetItemsProcessed(state.iterations());
+        state.SetBytesProcessed(state.iterations() * state.range(0));
+    }
+
+    void GatheredResponse(benchmark::State &state) {
+        const std::string body(static_cast<std::size_t>(state.range(0)), 'x');
+        Utils::EncodedVariants encoded;
+        encoded.build(body, "text/html");
+        Utils::Clock clock;
+        std::array<char, Utils::Templates::Headers::DATE_SIZE> date;
+        std::vector<boost::asio::const_buffer> buffers;
+        for (auto _ : state) {
+            // the same buffers the session hands to async_write; nothing of the body is copied
+            Utils::Templates::Headers::DATE(clock, date.data());
+            const std::string &head = encoded.head(Utils::Compression::IDENTITY);
+            std::size_t status_line_end = head.find("\r\n") + 2;
+            buffers.clear();
+            buffers.push_back(boost::asio::buffer(head.data(), status_line_end));
+            buffers.push_back(boost::asio::buffer(date));
+            buffers.push_back(boost::asio::buffer(Utils::Templates::Headers::KEEP_ALIVE));
+            buffers.push_back(boost::asio::buffer(head.data() + status_line_end, head.size() - status_line_end));
+            buffers.push_back(boost::asio::buffer(body));
+            benchmark::DoNotOptimize(buffers.data());
+        }
+        state.SetItemsProcessed(state.iterations());
+        state.SetBytesProcessed(state.iterations() * state.range(0));
+    }
+
+    /// The variant of a browser request, with all the compressed variants built
+    void ChooseVariant(benchmark::State &state) {
+        const std::string body(static_cast<std::size_t>(state.range(0)), 'x');
+        Utils::EncodedVariants encoded;
+        encoded.build(body, "text/html");
+        const std::string_view accept_encoding = "gzip, deflate, br, zstd";
+        for (auto _ : state) {
+            int coding = encoded.choose(accept_encoding);
+            const std::string &head = encoded.head(coding);
+            benchmark::DoNotOptimize(coding);
+            benchmark::DoNotOptimize(head.data());
+        }
+        state.SetItemsProcessed(state.iterations());
+    }
+}// namespace
+
+BENCHMARK(ConcatenatedResponse)->RangeMultiplier(64)->Range(16, 1 << 20);
+BENCHMARK(GatheredResponse)->RangeMultiplier(64)->Range(16, 1 << 20);
+BENCHMARK(ChooseVariant)->Arg(16)->Arg(64 * 1024);
+
+BENCHMARK_MAIN();
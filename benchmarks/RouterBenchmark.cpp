@@ -0,0 +1,108 @@
+///// ROUTER BENCHMARK /////
+// Endpoint lookup at 10 to 100k routes: the hash map of whole paths the server used to keep (endpoints_)
+// against the radix tree of Router, for exact paths, :param paths & misses; items_per_second is lookups per core
+// Build: g++ -std=c++17 -O2 -I.. RouterBenchmark.cpp -o RouterBenchmark -lbenchmark -lpthread
+// Dependency libraries: boost lib, google benchmark
+//////////////////////////
+
+#include "ServeMe.hpp"
+#include <benchmark/benchmark.h>
+#include <unordered_map>
+
+namespace {
+    /// "/api/v1/resource<i>/items", spread over a few prefixes like the routes of a real service
+    std::string exactPath(std::size_t i) {
+        static const char *prefixes[] = {"/api/v1/", "/api/v2/", "/static/", "/admin/"};
+        return prefixes[i % 4] + std::string("resource") + std::to_string(i) + "/items";
+    }
+
+    /// The lookups of one run: every path is registered, in an order unrelated to the registration one
+    std::vector<std::string> lookupPaths(std::size_t routes) {
+        std::vector<std::string> paths;
+        for (std::size_t i = 0; i < 1024; ++i) {
+            paths.push_back(exactPath((i * 7919) % routes));
+        }
+        return paths;
+    }
+
+    void HashMapLookup(benchmark::State &state) {
+        const auto routes = static_cast<std::size_t>(state.range(0));
+        std::unordered_map<std::string, std::pair<std::string, Utils::Method>> endpoints;
+        for (std::size_t i = 0; i < routes; ++i) {
+            endpoints[exactPath(i)] = {"Some data!", Utils::Method::GET};
+        }
+        std::vector<std::string> paths = lookupPaths(routes);
+        std::size_t next = 0;
+        for (auto _ : state) {
+            // the session copied the path out of the request line before the lookup
+            std::string path = paths[next++ & 1023];
+            auto it = endpoints.find(path);
+            bool found = it != endpoints.end() && it->second.second == Utils::Method::GET;
+            benchmark::DoNotOptimize(found);
+        }
+        state.SetItemsProcessed(state.iterations());
+    }
+
+    void RouterLookup(benchmark::State &state) {
+        const auto routes = static_cast<std::size_t>(state.range(0));
+        Utils::Router router;
+        for (std::size_t i = 0; i < routes; ++i) {
+            router.add(exactPath(i), Utils::Method::GET, Utils::Endpoint{"Some data!"});
+        }
+        std::vector<std::string> paths = lookupPaths(routes);
+        Utils::RouteParams params;
+        std::size_t next = 0;
+        for (auto _ : state) {
+            const Utils::Endpoint *endpoint = router.find(paths[next++ & 1023], Utils::Method::GET, params);
+            benchmark::DoNotOptimize(endpoint);
+        }
+        state.SetItemsProcessed(state.iterations());
+    }
+
+    /// "/users<i>/:id/posts": one parameter per lookup
+    void RouterParamLookup(benchmark::State &state) {
+        const auto routes = static_cast<std::size_t>(state.range(0));
+        Utils::Router router;
+        for (std::size_t i = 0; i < routes; ++i) {
+            router.add("/users" + std::to_string(i) + "/:id/posts", Utils::Method::GET, Utils::Endpoint{"A user"});
+        }
+        std::vector<std::string> paths;
+        for (std::size_t i = 0; i < 1024; ++i) {
+            paths.push_back("/users" + std::to_string((i * 7919) % routes) + "/" + std::to_string(i) + "/posts");
+        }
+        Utils::RouteParams params;
+        std::size_t next = 0;
+        for (auto _ : state) {
+            const Utils::Endpoint *endpoint = router.find(paths[next++ & 1023], Utils::Method::GET, params);
+            benchmark::DoNotOptimize(endpoint);
+        }
+        state.SetItemsProcessed(state.iterations());
+    }
+
+    /// Paths sharing the prefixes of the routes but matching none of them, i.e. 404s
+    void RouterMiss(benchmark::State &state) {
+        const auto routes = static_cast<std::size_t>(state.range(0));
+        Utils::Router router;
+        for (std::size_t i = 0; i < routes; ++i) {
+            router.add(exactPath(i), Utils::Method::GET, Utils::Endpoint{"Some data!"});
+        }
+        std::vector<std::string> paths = lookupPaths(routes);
+        for (std::string &path : paths) {
+            path += "/missing";
+        }
+        Utils::RouteParams params;
+        std::size_t next = 0;
+        for (auto _ : state) {
+            const Utils::Endpoint *endpoint = router.find(paths[next++ & 1023], Utils::Method::GET, params);
+            benchmark::DoNotOptimize(endpoint);
+        }
+        state.SetItemsProcessed(state.iterations());
+    }
+}// namespace
+
+BENCHMARK(HashMapLookup)->RangeMultiplier(10)->Range(10, 100000);
+BENCHMARK(RouterLookup)->RangeMultiplier(10)->Range(10, 100000);
+BENCHMARK(RouterParamLookup)->RangeMultiplier(10)->Range(10, 100000);
+BENCHMARK(RouterMiss)->RangeMultiplier(10)->Range(10, 100000);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,744 @@
+///// LOAD GENERATOR /////
+// An HTTP/1.1 load generator for tuning the server on the same box, no outside services needed
+// Closed loop: every connection keeps --pipeline requests in flight, the next one goes out when a response arrives
+// Open loop (--rate): the requests are due at a constant total rate whatever the responses do; the latency runs
+// from the due time, not from the send, so a stalled server is charged for the requests it delayed
+// (coordinated omission, see https://www.youtube.com/watch?v=lJ8ydIuPFeU); the service time is reported apart
+// Latencies go into log-linear (HDR-style) histograms with 128 sub-buckets per power of two, i.e. within 1%
+// Presets run an embedded HttpServer with the scenario unless --external is given:
+//   static    - compile-time static routes         file      - an @file: endpoint (memory-mapped)
+//   404       - a path without an endpoint          filecache - the @file: endpoint unmapped, served from the cache
+//   sendfile  - the @file: endpoint unmapped & the cache disabled, sent with sendfile per request
+//   chunked   - a chunked streaming endpoint, 16 chunks of 1 KB
+// Usage: LoadGenerator [--preset NAME | --path PATH...] [--host 127.0.0.1] [--port 18100] [--external]
+//                      [--connections 16] [--threads 1] [--server-threads 1] [--duration 10] [--warmup 1]
+//                      [--rate 0] [--pipeline 1] [--no-keep-alive] [--json FILE|-]
+// Build: g++ -std=c++17 -O2 -I.. LoadGenerator.cpp -o LoadGenerator -lpthread
+// Dependency libraries: boost lib
+//////////////////////////
+
+#include "ServeMe.hpp"
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+
+namespace {
+    typedef std::chrono::steady_clock::time_point TimePoint;
+
+    struct Options {
+        std::string preset;
+        std::vector<std::string> paths;  // requested in turn by every connection
+        std::string host = "127.0.0.1";
+        unsigned short port = 18100;
+        bool external = false;           // load a running server instead of the embedded one
+        std::size_t connections = 16;
+        unsigned threads = 1;            // client threads, the connections are spread over them
+        unsigned server_threads = 1;     // of the embedded server
+        double duration = 10;            // seconds, after the warmup
+        double warmup = 1;               // seconds of load that are not recorded
+        double rate = 0;                 // requests per second over all the connections, 0 for the closed loop
+        std::size_t pipeline = 1;        // requests in flight per connection
+        bool keep_alive = true;
+        std::string json;                // the file of the results, "-" for stdout
+    };
+
+    /// The scheme of Utils::Metrics::Histogram with 2^SUB_BITS sub-buckets per power of two, plain counters:
+    /// one histogram per client thread, merged at the end
+    class LatencyHistogram {
+    public:
+        static constexpr unsigned SUB_BITS = 7;
+        static constexpr unsigned MAX_EXPONENT = 40;  // about 18 minutes in nanoseconds
+        static constexpr std::size_t BUCKETS = (MAX_EXPONENT - SUB_BITS + 2) << SUB_BITS;
+
+        LatencyHistogram() : buckets(BUCKETS) {}
+
+        void record(std::uint64_t nanoseconds) noexcept {
+            ++buckets[index(nanoseconds)];
+            ++count;
+            sum += nanoseconds;
+            min = std::min(min, nanoseconds);
+            max = std::max(max, nanoseconds);
+        }
+
+        void merge(const LatencyHistogram &other) noexcept {
+            for (std::size_t i = 0; i < BUCKETS; ++i) {
+                buckets[i] += other.buckets[i];
+            }
+            count += other.count;
+            sum += other.sum;
+            min = std::min(min, other.min);
+            max = std::max(max, other.max);
+        }
+
+        /// @return the value at the quantile in nanoseconds, the exact maximum for 1
+        std::uint64_t quantile(double q) const noexcept {
+            if (count == 0) {
+                return 0;
+            }
+            auto rank = std::max<std::uint64_t>(1, static_cast<std::uint64_t>(std::ceil(q * static_cast<double>(count))));
+            std::uint64_t seen = 0;
+            for (std::size_t i = 0; i < BUCKETS; ++i) {
+                seen += buckets[i];
+                if (seen >= rank) {
+                    return std::clamp(value(i), min, max);
+                }
+            }
+            return max;
+        }
+
+        std::uint64_t total() const noexcept {
+            return count;
+        }
+
+        std::uint64_t lowest() const noexcept {
+            return count ? min : 0;
+        }
+
+        std::uint64_t highest() const noexcept {
+            return max;
+        }
+
+        double mean() const noexcept {
+            return count ? static_cast<double>(sum) / static_cast<double>(count) : 0;
+        }
+
+    private:
+        static std::size_t index(std::uint64_t value) noexcept {
+            if (value < (1u << SUB_BITS)) {
+                return static_cast<std::size_t>(value);
+            }
+            unsigned exponent = 63 - static_cast<unsigned>(__builtin_clzll(value));
+            if (exponent > MAX_EXPONENT) {
+                return BUCKETS - 1;
+            }
+            return ((exponent - SUB_BITS + 1) << SUB_BITS) + ((value >> (exponent - SUB_BITS)) & ((1u << SUB_BITS) - 1));
+        }
+
+        /// @return the middle of the values of the bucket
+        static std::uint64_t value(std::size_t index) noexcept {
+            if (index < (1u << SUB_BITS)) {
+                return index;
+            }
+            unsigned shift = static_cast<unsigned>(index >> SUB_BITS) - 1;
+            std::uint64_t lowest = ((std::uint64_t(1) << SUB_BITS) + (index & ((1u << SUB_BITS) - 1))) << shift;
+            return lowest + ((std::uint64_t(1) << shift) >> 1);
+        }
+
+        std::vector<std::uint64_t> buckets;
+        std::uint64_t count = 0;
+        std::uint64_t sum = 0;
+        std::uint64_t min = std::numeric_limits<std::uint64_t>::max();
+        std::uint64_t max = 0;
+    };
+
+    /// What one client thread measured
+    struct Results {
+        LatencyHistogram latency;  // from the due time (open loop) or the send (closed loop) to the response
+        LatencyHistogram service;  // from the send to the response
+        std::array<std::uint64_t, 5> statuses{};  // 1xx .. 5xx
+        std::uint64_t errors = 0;  // failed connects, reads & writes, malformed or unanswered responses
+        std::uint64_t bytes_received = 0;
+
+        void merge(const Results &other) {
+            latency.merge(other.latency);
+            service.merge(other.service);
+            for (std::size_t i = 0; i < statuses.size(); ++i) {
+                statuses[i] += other.statuses[i];
+            }
+            errors += other.errors;
+            bytes_received += other.bytes_received;
+        }
+    };
+
+    /// The embedded server of a preset: every scenario's endpoints, the cache & the mappings as the scenario needs them
+    class EmbeddedServer {
+    public:
+        EmbeddedServer(const Options &options, bool enable_cache, bool map_files)
+                : io_context(static_cast<int>(options.server_threads)),
+                  logger(std::make_shared<Utils::Logger>("LoadGenerator", "/dev/null", false)),
+                  server(std::make_shared<Utils::HttpServer>(io_context, logger, cache, options.port, enable_cache, false,
+                                                             options.server_threads > 1)) {
+            static constexpr Utils::StaticRoute routes[] = {{"/health", "OK"}, {"/version", "1.0", Utils::Method::GET, "text/plain"}};
+            static constexpr auto table = Utils::makeStaticRoutes(routes);
+            server->addStaticRoutes(table);
+            server->addEndpoint("/data", std::string(1024, 'd'), Utils::Method::GET);
+            server->addChunkedEndpoint("/stream", [](const Utils::RequestView &, Utils::HttpResponse &, Utils::ResponseStream::Ptr stream) {
+                for (int i = 0; i < 16; ++i) {
+                    stream->write(std::string(1024, 's'));
+                }
+                stream->end();
+            }, Utils::Method::GET);
+            char name[] = "/tmp/serveme-loadgen-XXXXXX";
+            int fd = mkstemp(name);
+            if (fd != -1) {
+                std::string content(16 * 1024, 'f');
+                if (::write(fd, content.data(), content.size()) == static_cast<ssize_t>(content.size())) {
+                    file = name;
+                    server->addEndpoint("/file", Utils::filePrefix + file, Utils::Method::GET);
+                }
+                ::close(fd);
+            }
+            Utils::SessionOptions session_options;
+            session_options.max_requests = std::numeric_limits<std::size_t>::max();
+            session_options.map_files = map_files;
+            server->setSessionOptions(session_options);
+            for (unsigned i = 0; i < options.server_threads; ++i) {
+                threads.emplace_back([this] { io_context.run(); });
+            }
+        }
+
+        ~EmbeddedServer() {
+            io_context.stop();
+            for (auto &thread : threads) {
+                thread.join();
+            }
+            if (!file.empty()) {
+                ::unlink(file.c_str());
+            }
+        }
+
+    private:
+        boost::asio::io_context io_context;
+        Utils::Cache cache;
+        Utils::Logger::Ptr logger;
+        Utils::HttpServer::Ptr server;
+        std::vector<std::thread> threads;
+        std::string file;
+    };
+
+    class Worker;
+
+    /// One client connection: sends the requests of the loop, parses the Content-Length framed responses
+    class Connection : public std::enable_shared_from_this<Connection> {
+    public:
+        Connection(Worker &worker, boost::asio::io_context &io_context, std::size_t index);
+
+        void start();
+
+        void stop() {
+            stopped = true;
+            boost::system::error_code ignored_ec;
+            socket.close(ignored_ec);
+            timer.cancel();
+            retry_timer.cancel();
+        }
+
+    private:
+        /// A request sent or due: the latency runs from due, the service time from sent
+        struct Request {
+            TimePoint due;
+            TimePoint sent;
+        };
+
+        void connect();
+        void reconnect();
+        void schedule();
+        void fill();
+        void write();
+        void read();
+        bool parse();
+        void complete(unsigned status, bool close);
+
+        Worker &worker;
+        boost::asio::ip::tcp::socket socket;
+        boost::asio::steady_timer timer;  // the due times of the open loop
+        boost::asio::steady_timer retry_timer;
+        std::size_t next_path;
+        bool connected = false;
+        bool writing = false;
+        bool stopped = false;
+        TimePoint next_due;
+        std::deque<TimePoint> due;       // the open loop requests waiting for a free place in the pipeline
+        std::deque<Request> in_flight;   // sent, in the order of the responses
+        std::string out;                 // the requests to write next
+        std::string writing_buffer;      // the requests being written
+        std::string in;                  // received, not parsed yet
+        std::array<char, 64 * 1024> chunk;
+    };
+
+    /// A client thread with its io_context, connections & results
+    class Worker {
+    public:
+        Worker(const Options &options, const boost::asio::ip::tcp::endpoint &target, TimePoint record_from,
+               std::size_t first, std::size_t count)
+                : options(options), target(target), record_from(record_from), io_context(1) {
+            for (std::size_t i = 0; i < count; ++i) {
+                connections.push_back(std::make_shared<Connection>(*this, io_context, first + i));
+            }
+            for (const std::string &path : options.paths) {
+                requests.push_back("GET " + path + " HTTP/1.1\r\nHost: " + options.host + "\r\n"
+                                   + (options.keep_alive ? "" : "Connection: close\r\n") + "\r\n");
+            }
+        }
+
+        void run() {
+            for (auto &connection : connections) {
+                connection->start();
+            }
+            io_context.run();
+        }
+
+        void stop() {
+            boost::asio::post(io_context, [this] {
+                for (auto &connection : connections) {
+                    connection->stop();
+                }
+            });
+        }
+
+        const Options &options;
+        const boost::asio::ip::tcp::endpoint target;
+        const TimePoint record_from;   // the end of the warmup
+        std::vector<std::string> requests;
+        Results results;
+
+    private:
+        boost::asio::io_context io_context;
+        std::vector<std::shared_ptr<Connection>> connections;
+    };
+
+    Connection::Connection(Worker &worker, boost::asio::io_context &io_context, std::size_t index)
+            : worker(worker), socket(io_context), timer(io_context), retry_timer(io_context), next_path(index) {}
+
+    void Connection::start() {
+        if (worker.options.rate > 0) {
+            // the connections share the rate, their due times interleave
+            auto interval = std::chrono::duration<double>(static_cast<double>(worker.options.connections) / worker.options.rate);
+            next_due = std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    interval * (static_cast<double>(next_path % worker.options.connections) / static_cast<double>(worker.options.connections)));
+            schedule();
+        }
+        connect();
+    }
+
+    void Connection::connect() {
+        auto self = shared_from_this();
+        socket.async_connect(worker.target, [this, self](const boost::system::error_code &ec) {
+            if (stopped) {
+                return;
+            }
+            if (ec) {
+                ++worker.results.errors;
+                retry_timer.expires_after(std::chrono::milliseconds(100));
+                retry_timer.async_wait([this, self](const boost::system::error_code &ec) {
+                    if (!ec && !stopped) {
+                        reconnect();
+                    }
+                });
+                return;
+            }
+            boost::system::error_code ignored_ec;
+            socket.set_option(boost::asio::ip::tcp::no_delay(true), ignored_ec);
+            connected = true;
+            read();
+            fill();
+        });
+    }
+
+    /// The requests in flight are lost: counted as errors, the open loop ones are not due again
+    void Connection::reconnect() {
+        worker.results.errors += in_flight.size();
+        in_flight.clear();
+        out.clear();
+        in.clear();
+        connected = writing = false;
+        boost::system::error_code ignored_ec;
+        socket.close(ignored_ec);
+        if (!stopped) {
+            connect();
+        }
+    }
+
+    /// Makes the requests of the open loop due at their times, however late the thread wakes up
+    void Connection::schedule() {
+        timer.expires_at(next_due);
+        timer.async_wait([this, self = shared_from_this()](const boost::system::error_code &ec) {
+            if (stopped || ec) {
+                return;
+            }
+            auto interval = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::duration<double>(static_cast<double>(worker.options.connections) / worker.options.rate));
+            TimePoint now = std::chrono::steady_clock::now();
+            while (next_due <= now) {
+                due.push_back(next_due);
+                next_due += interval;
+            }
+            fill();
+            schedule();
+        });
+    }
+
+    /// Queues the requests the pipeline has room for
+    void Connection::fill() {
+        if (!connected) {
+            return;
+        }
+        std::size_t window = worker.options.keep_alive ? worker.options.pipeline : 1;
+        TimePoint now = std::chrono::steady_clock::now();
+        while (in_flight.size() < window && (worker.options.rate <= 0 || !due.empty())) {
+            TimePoint due_time = now;
+            if (worker.options.rate > 0) {
+                due_time = due.front();
+                due.pop_front();
+            }
+            in_flight.push_back({due_time, now});
+            out += worker.requests[next_path++ % worker.requests.size()];
+        }
+        write();
+    }
+
+    void Connection::write() {
+        if (writing || out.empty()) {
+            return;
+        }
+        writing = true;
+        writing_buffer.swap(out);
+        out.clear();
+        boost::asio::async_write(socket, boost::asio::buffer(writing_buffer),
+                                 [this, self = shared_from_this()](const boost::system::error_code &ec, std::size_t) {
+                                     writing = false;
+                                     if (stopped) {
+                                         return;
+                                     }
+                                     if (ec) {
+                                         reconnect();
+                                         return;
+                                     }
+                                     write();
+                                 });
+    }
+
+    void Connection::read() {
+        socket.async_read_some(boost::asio::buffer(chunk), [this, self = shared_from_this()](const boost::system::error_code &ec, std::size_t length) {
+            if (stopped) {
+                return;
+            }
+            if (ec) {
+                // the server may close a connection after a response, e.g. at its requests limit
+                if (ec != boost::asio::error::eof || !in_flight.empty()) {
+                    ++worker.results.errors;
+                }
+                reconnect();
+                return;
+            }
+            if (std::chrono::steady_clock::now() >= worker.record_from) {
+                worker.results.bytes_received += length;
+            }
+            in.append(chunk.data(), length);
+            if (!parse()) {
+                ++worker.results.errors;
+                reconnect();
+                return;
+            }
+            if (connected) {
+                read();
+            }
+        });
+    }
+
+    /// Finds the end of a chunked body: the size lines, the chunks, the last chunk & the trailers
+    /// @param pos - the first byte of the body
+    /// @param end - receives the position after the body, std::string::npos if it is not complete yet
+    /// @return false if the framing is malformed
+    bool chunkedEnd(const std::string &in, std::size_t pos, std::size_t &end) {
+        end = std::string::npos;
+        while (true) {
+            std::size_t line_end = in.find("\r\n", pos);
+            if (line_end == std::string::npos) {
+                return true;
+            }
+            std::string_view line(in.data() + pos, line_end - pos);
+            line = line.substr(0, line.find(';'));  // chunk extensions
+            std::size_t size = 0;
+            auto [digits_end, ec] = std::from_chars(line.data(), line.data() + line.size(), size, 16);
+            if (ec != std::errc() || Utils::trim(std::string_view(digits_end, line.data() + line.size() - digits_end)).size() != 0) {
+                return false;
+            }
+            pos = line_end + 2;
+            if (size == 0) {
+                break;
+            }
+            if (in.size() < pos + size + 2) {
+                return true;
+            }
+            if (in.compare(pos + size, 2, "\r\n") != 0) {
+                return false;
+            }
+            pos += size + 2;
+        }
+        // the trailer lines, up to an empty one
+        while (true) {
+            std::size_t line_end = in.find("\r\n", pos);
+            if (line_end == std::string::npos) {
+                return true;
+            }
+            if (line_end == pos) {
+                end = pos + 2;
+                return true;
+            }
+            pos = line_end + 2;
+        }
+    }
+
+    /// Completes every whole response in the buffer
+    /// @return false if a response is malformed or framed neither by Content-Length nor by chunks
+    bool Connection::parse() {
+        std::size_t begin = 0;
+        while (true) {
+            std::size_t head_end = in.find("\r\n\r\n", begin);
+            if (head_end == std::string::npos) {
+                break;
+            }
+            std::string_view head(in.data() + begin, head_end - begin);
+            if (head.size() < 12 || head.compare(0, 5, "HTTP/") != 0 || head[9] < '1' || head[9] > '5') {
+                return false;
+            }
+            char status_class = head[9];
+            std::size_t length = 0;
+            bool close = false;
+            bool chunked = false;
+            // the responses without a body
+            bool framed = status_class == '1' || head.compare(9, 3, "204") == 0 || head.compare(9, 3, "304") == 0;
+            for (std::size_t line = head.find("\r\n"); line != std::string_view::npos; line = head.find("\r\n", line + 2)) {
+                std::string_view header = head.substr(line + 2, head.find("\r\n", line + 2) - line - 2);
+                if (header.size() > 15 && Utils::iequals(header.substr(0, 15), "Content-Length:")) {
+                    std::string_view value = Utils::trim(header.substr(15));
+                    framed = std::from_chars(value.data(), value.data() + value.size(), length).ec == std::errc();
+                } else if (header.size() > 18 && Utils::iequals(header.substr(0, 18), "Transfer-Encoding:")) {
+                    chunked = framed = Utils::hasToken(header.substr(18), "chunked");
+                } else if (header.size() > 11 && Utils::iequals(header.substr(0, 11), "Connection:")) {
+                    close = Utils::hasToken(header.substr(11), "close");
+                }
+            }
+            if (!framed) {
+                return false;
+            }
+            std::size_t end = head_end + 4 + length;
+            if (chunked) {
+                if (!chunkedEnd(in, head_end + 4, end)) {
+                    return false;
+                }
+            } else if (in.size() < end) {
+                end = std::string::npos;
+            }
+            if (end == std::string::npos) {
+                break;
+            }
+            begin = end;
+            if (status_class != '1') {
+                complete(static_cast<unsigned>(status_class - '1'), close);
+                if (!connected) {
+                    return true;  // reconnected, the buffer is gone
+                }
+            }
+        }
+        in.erase(0, begin);
+        return true;
+    }
+
+    /// @param status - the status class of the response, 0 for 1xx
+    /// @param close - the server closes the connection after the response, e.g. a 503 of its admission control
+    void Connection::complete(unsigned status, bool close) {
+        if (in_flight.empty()) {
+            ++worker.results.errors;  // a response to nothing
+            return;
+        }
+        Request request = in_flight.front();
+        in_flight.pop_front();
+        TimePoint now = std::chrono::steady_clock::now();
+        if (request.due >= worker.record_from) {
+            worker.results.latency.record(static_cast<std::uint64_t>((now - request.due).count()));
+            worker.results.service.record(static_cast<std::uint64_t>((now - request.sent).count()));
+            ++worker.results.statuses[std::min<std::size_t>(status, 4)];
+        }
+        if (!worker.options.keep_alive || close) {
+            reconnect();
+            return;
+        }
+        fill();
+    }
+
+    void usage() {
+        std::fprintf(stderr, "Usage: LoadGenerator [--preset static|file|404|filecache|sendfile|chunked | --path PATH...] [--host HOST]\n"
+                             "                     [--port PORT] [--external] [--connections N] [--threads N] [--server-threads N]\n"
+                             "                     [--duration SECONDS] [--warmup SECONDS] [--rate REQUESTS_PER_SECOND]\n"
+                             "                     [--pipeline N] [--no-keep-alive] [--json FILE|-]\n");
+    }
+
+    /// @return false if the arguments are invalid
+    bool parseOptions(int argc, char **argv, Options &options) {
+        for (int i = 1; i < argc; ++i) {
+            std::string name = argv[i];
+            if (name == "--external") {
+                options.external = true;
+                continue;
+            }
+            if (name == "--no-keep-alive") {
+                options.keep_alive = false;
+                continue;
+            }
+            if (i + 1 == argc) {
+                return false;
+            }
+            std::string value = argv[++i];
+            if (name == "--preset") {
+                options.preset = value;
+            } else if (name == "--path") {
+                options.paths.push_back(value);
+            } else if (name == "--host") {
+                options.host = value;
+            } else if (name == "--port") {
+                options.port = static_cast<unsigned short>(std::stoul(value));
+            } else if (name == "--connections") {
+                options.connections = std::stoul(value);
+            } else if (name == "--threads") {
+                options.threads = static_cast<unsigned>(std::stoul(value));
+            } else if (name == "--server-threads") {
+                options.server_threads = static_cast<unsigned>(std::stoul(value));
+            } else if (name == "--duration") {
+                options.duration = std::stod(value);
+            } else if (name == "--warmup") {
+                options.warmup = std::stod(value);
+            } else if (name == "--rate") {
+                options.rate = std::stod(value);
+            } else if (name == "--pipeline") {
+                options.pipeline = std::stoul(value);
+            } else if (name == "--json") {
+                options.json = value;
+            } else {
+                return false;
+            }
+        }
+        static const std::map<std::string, std::vector<std::string>> presets = {
+                {"static", {"/health", "/version"}},
+                {"file", {"/file"}},
+                {"404", {"/missing/page"}},
+                {"filecache", {"/file"}},
+                {"sendfile", {"/file"}},
+                {"chunked", {"/stream"}},
+        };
+        if (!options.preset.empty()) {
+            auto preset = presets.find(options.preset);
+            if (preset == presets.end()) {
+                return false;
+            }
+            if (options.paths.empty()) {
+                options.paths = preset->second;
+            }
+        } else {
+            options.external = true;  // nothing to embed
+        }
+        return !options.paths.empty() && options.connections > 0 && options.threads > 0 && options.server_threads > 0
+               && options.pipeline > 0 && options.duration > 0 && options.warmup >= 0 && options.rate >= 0;
+    }
+
+    std::string latencyJson(const LatencyHistogram &histogram) {
+        char buffer[512];
+        auto us = [](std::uint64_t nanoseconds) { return static_cast<double>(nanoseconds) / 1000; };
+        std::snprintf(buffer, sizeof(buffer),
+                      "{\"min\": %.3f, \"mean\": %.3f, \"p50\": %.3f, \"p90\": %.3f, \"p99\": %.3f, \"p99.9\": %.3f, "
+                      "\"p99.99\": %.3f, \"max\": %.3f}",
+                      us(histogram.lowest()), histogram.mean() / 1000, us(histogram.quantile(0.5)), us(histogram.quantile(0.9)),
+                      us(histogram.quantile(0.99)), us(histogram.quantile(0.999)), us(histogram.quantile(0.9999)),
+                      us(histogram.highest()));
+        return buffer;
+    }
+
+    void report(const Options &options, const Results &results) {
+        double rps = static_cast<double>(results.latency.total()) / options.duration;
+        std::printf("%s: %s loop, %zu connections, pipeline %zu%s\n",
+                    options.preset.empty() ? options.paths.front().c_str() : options.preset.c_str(),
+                    options.rate > 0 ? "open" : "closed", options.connections, options.pipeline,
+                    options.keep_alive ? "" : ", no keep-alive");
+        std::printf("  requests %" PRIu64 ", %.0f/s, errors %" PRIu64 ", received %.1f MiB\n", results.latency.total(), rps,
+                    results.errors, static_cast<double>(results.bytes_received) / (1024 * 1024));
+        std::printf("  status 2xx %" PRIu64 ", 3xx %" PRIu64 ", 4xx %" PRIu64 ", 5xx %" PRIu64 "\n",
+                    results.statuses[1], results.statuses[2], results.statuses[3], results.statuses[4]);
+        std::printf("  latency (us)      %s\n", latencyJson(results.latency).c_str());
+        if (options.rate > 0) {
+            std::printf("  service time (us) %s\n", latencyJson(results.service).c_str());
+        }
+        if (options.json.empty()) {
+            return;
+        }
+        std::string paths;
+        for (const std::string &path : options.paths) {
+            paths += (paths.empty() ? "\"" : ", \"") + path + "\"";
+        }
+        char head[1024];
+        std::snprintf(head, sizeof(head),
+                      "{\"preset\": \"%s\", \"paths\": [%s], \"mode\": \"%s\", \"rate\": %.1f, \"connections\": %zu, "
+                      "\"threads\": %u, \"pipeline\": %zu, \"keep_alive\": %s, \"duration_s\": %.3f, \"requests\": %" PRIu64 ", "
+                      "\"requests_per_second\": %.1f, \"errors\": %" PRIu64 ", \"bytes_received\": %" PRIu64 ", "
+                      "\"status\": {\"1xx\": %" PRIu64 ", \"2xx\": %" PRIu64 ", \"3xx\": %" PRIu64 ", \"4xx\": %" PRIu64 ", \"5xx\": %" PRIu64 "}, ",
+                      options.preset.c_str(), paths.c_str(), options.rate > 0 ? "open" : "closed", options.rate, options.connections,
+                      options.threads, options.pipeline, options.keep_alive ? "true" : "false", options.duration,
+                      results.latency.total(), rps, results.errors, results.bytes_received, results.statuses[0],
+                      results.statuses[1], results.statuses[2], results.statuses[3], results.statuses[4]);
+        // the closed loop sends when the previous response arrives: its latency is the service time
+        std::string json = std::string(head) + "\"coordinated_omission_corrected\": " + (options.rate > 0 ? "true" : "false")
+                           + ", \"latency_us\": " + latencyJson(results.latency)
+                           + ", \"service_time_us\": " + latencyJson(results.service) + "}\n";
+        if (options.json == "-") {
+            std::fputs(json.c_str(), stdout);
+        } else if (std::FILE *file = std::fopen(options.json.c_str(), "w")) {
+            std::fputs(json.c_str(), file);
+            std::fclose(file);
+        } else {
+            std::fprintf(stderr, "Can not write %s\n", options.json.c_str());
+        }
+    }
+}// namespace
+
+int main(int argc, char **argv) {
+    Options options;
+    try {
+        if (!parseOptions(argc, argv, options)) {
+            usage();
+            return 2;
+        }
+    } catch (const std::exception &) {
+        usage();
+        return 2;
+    }
+    std::unique_ptr<EmbeddedServer> server;
+    if (!options.external) {
+        server = std::make_unique<EmbeddedServer>(options, options.preset != "sendfile",
+                                                  options.preset != "filecache" && options.preset != "sendfile");
+    }
+    boost::system::error_code ec;
+    boost::asio::ip::address address = boost::asio::ip::make_address(options.host, ec);
+    if (ec) {
+        std::fprintf(stderr, "Invalid host address %s\n", options.host.c_str());
+        return 2;
+    }
+    boost::asio::ip::tcp::endpoint target(address, options.port);
+
+    TimePoint record_from = std::chrono::steady_clock::now()
+                            + std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::duration<double>(options.warmup));
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::size_t first = 0;
+    for (unsigned i = 0; i < options.threads; ++i) {
+        std::size_t count = options.connections / options.threads + (i < options.connections % options.threads ? 1 : 0);
+        workers.push_back(std::make_unique<Worker>(options, target, record_from, first, count));
+        first += count;
+    }
+    std::vector<std::thread> threads;
+    for (auto &worker : workers) {
+        threads.emplace_back([&worker] { worker->run(); });
+    }
+    std::this_thread::sleep_until(record_from + std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::duration<double>(options.duration)));
+    for (auto &worker : workers) {
+        worker->stop();
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    Results results;
+    for (auto &worker : workers) {
+        results.merge(worker->results);
+    }
+    report(options, results);
+    return 0;
+}